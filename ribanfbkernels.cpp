@@ -0,0 +1,125 @@
+/*  Pixel kernels for simple framebuffer graphics library
+    Copyright:  riban 2019
+    Author:     Brian Walotn (brian@riban.co.uk)
+    License:    LGPL
+*/
+#include "ribanfbkernels.h"
+#include <string.h> //Provides memcpy
+
+//Kernel bodies are always inlined into each instruction set variant so the compiler optimises each for its target.
+//This file is built with -O3 so that loops are vectorised, otherwise all variants are the same scalar code.
+#define KERNEL_BODY static inline __attribute__((always_inline))
+
+KERNEL_BODY void fillSpan16(uint16_t* pDst, uint16_t colour, uint32_t nCount)
+{
+    for(uint32_t n = 0; n < nCount; ++n)
+        pDst[n] = colour;
+}
+
+KERNEL_BODY void fillSpan32(uint32_t* pDst, uint32_t colour, uint32_t nCount)
+{
+    for(uint32_t n = 0; n < nCount; ++n)
+        pDst[n] = colour;
+}
+
+//Source pixel size is passed as a constant by the wrappers below so the compiler can vectorise the interleaved loads
+KERNEL_BODY void convertRow16(const uint8_t* pSrc, uint32_t nSrcBytes, uint16_t* pDst, uint32_t nCount, const fbFormat& format)
+{
+    const uint32_t nRedMask = format.redMask, nGreenMask = format.greenMask, nBlueMask = format.blueMask;
+    const uint32_t nRedShift = format.redShift, nGreenShift = format.greenShift, nBlueShift = format.blueShift;
+    for(uint32_t n = 0; n < nCount; ++n, pSrc += nSrcBytes)
+    {
+        uint32_t nColour = (pSrc[2] << 16) | (pSrc[1] << 8) | pSrc[0];
+        pDst[n] = ((nColour & nRedMask) >> nRedShift) | ((nColour & nGreenMask) >> nGreenShift) | ((nColour & nBlueMask) >> nBlueShift);
+    }
+}
+
+KERNEL_BODY void convertRow32(const uint8_t* pSrc, uint32_t nSrcBytes, uint32_t* pDst, uint32_t nCount)
+{
+    for(uint32_t n = 0; n < nCount; ++n, pSrc += nSrcBytes)
+        pDst[n] = (pSrc[2] << 16) | (pSrc[1] << 8) | pSrc[0];
+}
+
+KERNEL_BODY void convertRow16Bgr(const uint8_t* pSrc, uint16_t* pDst, uint32_t nCount, const fbFormat& format)
+{
+    convertRow16(pSrc, 3, pDst, nCount, format);
+}
+
+KERNEL_BODY void convertRow16Bgrx(const uint8_t* pSrc, uint16_t* pDst, uint32_t nCount, const fbFormat& format)
+{
+    convertRow16(pSrc, 4, pDst, nCount, format);
+}
+
+KERNEL_BODY void convertRow32Bgr(const uint8_t* pSrc, uint32_t* pDst, uint32_t nCount)
+{
+    convertRow32(pSrc, 3, pDst, nCount);
+}
+
+KERNEL_BODY void convertRow32Bgrx(const uint8_t* pSrc, uint32_t* pDst, uint32_t nCount)
+{
+    convertRow32(pSrc, 4, pDst, nCount);
+}
+
+//Glyph rows are painted a whole byte (8 pixels) at a time as one vector (GCC vector extension), selecting each pixel
+//with a mask rather than a branch. Partial bytes at each end are painted a bit at a time.
+template <typename PIXEL> KERNEL_BODY void glyphRow(const uint8_t* pBits, uint32_t nFirstBit, PIXEL* pDst, uint32_t nCount, PIXEL colour)
+{
+    typedef PIXEL pixels8 __attribute__((vector_size(8 * sizeof(PIXEL))));
+    const pixels8 vBit = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+    const pixels8 vColour = vBit * 0 + colour;
+    uint32_t n = 0;
+    for(; n < nCount && ((nFirstBit + n) & 7); ++n)
+        if(pBits[(nFirstBit + n) >> 3] & (0x80 >> ((nFirstBit + n) & 7)))
+            pDst[n] = colour;
+    for(; n + 8 <= nCount; n += 8)
+    {
+        PIXEL nByte = pBits[(nFirstBit + n) >> 3];
+        if(nByte == 0)
+            continue;
+        pixels8 vMask = (pixels8)((vBit & nByte) != 0);
+        pixels8 vDst;
+        memcpy(&vDst, pDst + n, sizeof(vDst)); //Destination need not be aligned
+        vDst = (vDst & ~vMask) | (vColour & vMask);
+        memcpy(pDst + n, &vDst, sizeof(vDst));
+    }
+    for(; n < nCount; ++n)
+        if(pBits[(nFirstBit + n) >> 3] & (0x80 >> ((nFirstBit + n) & 7)))
+            pDst[n] = colour;
+}
+
+KERNEL_BODY void glyphRow16(const uint8_t* pBits, uint32_t nFirstBit, uint16_t* pDst, uint32_t nCount, uint16_t colour)
+{
+    glyphRow<uint16_t>(pBits, nFirstBit, pDst, nCount, colour);
+}
+
+KERNEL_BODY void glyphRow32(const uint8_t* pBits, uint32_t nFirstBit, uint32_t* pDst, uint32_t nCount, uint32_t colour)
+{
+    glyphRow<uint32_t>(pBits, nFirstBit, pDst, nCount, colour);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//GCC builds each clone and an ifunc resolver that selects the clone using cpuid
+#define KERNEL_VARIANTS(name, kernel, params, args) \
+    __attribute__((target_clones("default", "sse4.2", "avx2"))) void name params { kernel args; }
+#elif defined(__arm__) && defined(__linux__)
+#include <asm/hwcap.h> //Provides HWCAP_NEON
+//Build baseline and NEON variants and an ifunc resolver that selects using the hardware capabilities passed by the loader
+#define KERNEL_VARIANTS(name, kernel, params, args) \
+    static void kernel##Generic params { kernel args; } \
+    __attribute__((target("fpu=neon"))) static void kernel##Neon params { kernel args; } \
+    extern "C" { static decltype(&kernel##Generic) kernel##Resolve(unsigned long hwcap) { return (hwcap & HWCAP_NEON) ? kernel##Neon : kernel##Generic; } } \
+    void name params __attribute__((ifunc(#kernel "Resolve")));
+#else
+//Single variant (e.g. 64-bit ARM where NEON is part of the baseline instruction set)
+#define KERNEL_VARIANTS(name, kernel, params, args) \
+    void name params { kernel args; }
+#endif
+
+KERNEL_VARIANTS(fbFillSpan16, fillSpan16, (uint16_t* pDst, uint16_t colour, uint32_t nCount), (pDst, colour, nCount))
+KERNEL_VARIANTS(fbFillSpan32, fillSpan32, (uint32_t* pDst, uint32_t colour, uint32_t nCount), (pDst, colour, nCount))
+KERNEL_VARIANTS(fbConvertRow16Bgr, convertRow16Bgr, (const uint8_t* pSrc, uint16_t* pDst, uint32_t nCount, const fbFormat& format), (pSrc, pDst, nCount, format))
+KERNEL_VARIANTS(fbConvertRow16Bgrx, convertRow16Bgrx, (const uint8_t* pSrc, uint16_t* pDst, uint32_t nCount, const fbFormat& format), (pSrc, pDst, nCount, format))
+KERNEL_VARIANTS(fbConvertRow32Bgr, convertRow32Bgr, (const uint8_t* pSrc, uint32_t* pDst, uint32_t nCount), (pSrc, pDst, nCount))
+KERNEL_VARIANTS(fbConvertRow32Bgrx, convertRow32Bgrx, (const uint8_t* pSrc, uint32_t* pDst, uint32_t nCount), (pSrc, pDst, nCount))
+KERNEL_VARIANTS(fbGlyphRow16, glyphRow16, (const uint8_t* pBits, uint32_t nFirstBit, uint16_t* pDst, uint32_t nCount, uint16_t colour), (pBits, nFirstBit, pDst, nCount, colour))
+KERNEL_VARIANTS(fbGlyphRow32, glyphRow32, (const uint8_t* pBits, uint32_t nFirstBit, uint32_t* pDst, uint32_t nCount, uint32_t colour), (pBits, nFirstBit, pDst, nCount, colour))
@@ -0,0 +1,89 @@
+/*  Pixel kernels for simple framebuffer graphics library
+    Copyright:  riban 2019
+    Author:     Brian Walotn (brian@riban.co.uk)
+    License:    LGPL
+*/
+#pragma once
+
+#include <stdint.h> //Provides fixed size int types
+
+/*  Hot inner loops used by ribanfblib. Each kernel is compiled in several instruction set variants
+    and the best variant for the running CPU is selected once when the library is loaded (GNU ifunc):
+        x86:        baseline, SSE4.2, AVX2
+        32-bit ARM: baseline, NEON
+        64-bit ARM: NEON is always available so a single variant is built
+*/
+
+/** Framebuffer colour format used to convert 32-bit RGB colour to 16-bit framebuffer colour
+*/
+struct fbFormat
+{
+    uint32_t redMask; //32-bit mask for red colour component
+    uint32_t greenMask; //32-bit mask for green colour component
+    uint32_t blueMask; //32-bit mask for blue colour component
+    uint32_t redShift; //Quantity of bits to shift red colour component right
+    uint32_t greenShift; //Quantity of bits to shift green colour component right
+    uint32_t blueShift; //Quantity of bits to shift blue colour component right
+};
+
+/** @brief  Fill a span of 16-bit pixels with a colour
+*   @param  pDst Pointer to first pixel
+*   @param  colour Colour in framebuffer format
+*   @param  nCount Quantity of pixels
+*/
+void fbFillSpan16(uint16_t* pDst, uint16_t colour, uint32_t nCount);
+
+/** @brief  Fill a span of 32-bit pixels with a colour
+*   @param  pDst Pointer to first pixel
+*   @param  colour Colour in framebuffer format
+*   @param  nCount Quantity of pixels
+*/
+void fbFillSpan32(uint32_t* pDst, uint32_t colour, uint32_t nCount);
+
+/** @brief  Convert a row of 3-byte BGR pixels to 16-bit framebuffer format
+*   @param  pSrc Pointer to first source pixel (blue, green, red)
+*   @param  pDst Pointer to first destination pixel
+*   @param  nCount Quantity of pixels
+*   @param  format Framebuffer colour format
+*/
+void fbConvertRow16Bgr(const uint8_t* pSrc, uint16_t* pDst, uint32_t nCount, const fbFormat& format);
+
+/** @brief  Convert a row of 4-byte BGRX pixels to 16-bit framebuffer format
+*   @param  pSrc Pointer to first source pixel (blue, green, red, unused)
+*   @param  pDst Pointer to first destination pixel
+*   @param  nCount Quantity of pixels
+*   @param  format Framebuffer colour format
+*/
+void fbConvertRow16Bgrx(const uint8_t* pSrc, uint16_t* pDst, uint32_t nCount, const fbFormat& format);
+
+/** @brief  Convert a row of 3-byte BGR pixels to 32-bit framebuffer format
+*   @param  pSrc Pointer to first source pixel (blue, green, red)
+*   @param  pDst Pointer to first destination pixel
+*   @param  nCount Quantity of pixels
+*/
+void fbConvertRow32Bgr(const uint8_t* pSrc, uint32_t* pDst, uint32_t nCount);
+
+/** @brief  Convert a row of 4-byte BGRX pixels to 32-bit framebuffer format
+*   @param  pSrc Pointer to first source pixel (blue, green, red, unused)
+*   @param  pDst Pointer to first destination pixel
+*   @param  nCount Quantity of pixels
+*/
+void fbConvertRow32Bgrx(const uint8_t* pSrc, uint32_t* pDst, uint32_t nCount);
+
+/** @brief  Paint set bits of a row of a monochrome glyph to 16-bit pixels
+*   @param  pBits Pointer to glyph row (most significant bit first)
+*   @param  nFirstBit Index of first bit to paint
+*   @param  pDst Pointer to destination pixel of first bit
+*   @param  nCount Quantity of bits / pixels
+*   @param  colour Colour in framebuffer format
+*/
+void fbGlyphRow16(const uint8_t* pBits, uint32_t nFirstBit, uint16_t* pDst, uint32_t nCount, uint16_t colour);
+
+/** @brief  Paint set bits of a row of a monochrome glyph to 32-bit pixels
+*   @param  pBits Pointer to glyph row (most significant bit first)
+*   @param  nFirstBit Index of first bit to paint
+*   @param  pDst Pointer to destination pixel of first bit
+*   @param  nCount Quantity of bits / pixels
+*   @param  colour Colour in framebuffer format
+*/
+void fbGlyphRow32(const uint8_t* pBits, uint32_t nFirstBit, uint32_t* pDst, uint32_t nCount, uint32_t colour);
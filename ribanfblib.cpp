@@ -4,14 +4,18 @@
     License:    LGPL
 */
 #include "ribanfblib.h"
+#include "ribanfbkernels.h" //Provides optimised pixel kernels
 #include <assert.h> //Provides assert error checking
 #include <stdio.h>
+#include <string.h> //Provides memset, memcpy
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <linux/types.h>
 #include <cmath> //Provides sin,cos
+#include <algorithm> //Provides std::min, std::max
 #define PI 3.1415926535897932
 
 ribanfblib::ribanfblib(const char* device)
@@ -23,9 +27,73 @@ ribanfblib::ribanfblib(const char* device)
     assert(ioctl(m_nFbHandle, FBIOGET_FSCREENINFO, &m_fbFixScreeninfo) == 0);
     m_pFbmmap = (uint8_t *)mmap(0, m_fbFixScreeninfo.smem_len, PROT_READ | PROT_WRITE, MAP_SHARED, m_nFbHandle, 0);
     assert(m_pFbmmap != MAP_FAILED);
+    m_pAtlas = std::make_shared<spriteAtlas>();
+    init("/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf", 16, 16);
+}
+
+ribanfblib::ribanfblib(ribanfblib& format, uint32_t width, uint32_t height)
+{
+    //Create surface in memory with same colour format as another framebuffer
+    m_nFbHandle = -1;
+    m_fbVarScreeninfo = format.m_fbVarScreeninfo;
+    m_fbFixScreeninfo = format.m_fbFixScreeninfo;
+    m_fbVarScreeninfo.xres = m_fbVarScreeninfo.xres_virtual = width;
+    m_fbVarScreeninfo.yres = m_fbVarScreeninfo.yres_virtual = height;
+    m_fbVarScreeninfo.xoffset = m_fbVarScreeninfo.yoffset = 0;
+    m_fbFixScreeninfo.line_length = width * GetDepth() / 8;
+    m_fbFixScreeninfo.smem_len = m_fbFixScreeninfo.line_length * height;
+    m_pFbmmap = new uint8_t[m_fbFixScreeninfo.smem_len](); //Zero initialised (black)
+    m_pAtlas = format.m_pAtlas; //Same atlas object so each sprite handle means the same image in both instances
+    init(format.m_sFontPath, format.m_nFontHeight, format.m_nFontWidth);
+}
+
+ribanfblib::ribanfblib(uint32_t width, uint32_t height, uint32_t depth)
+{
+    //Create surface in memory with a standard packed pixel format
+    m_nFbHandle = -1;
+    memset(&m_fbVarScreeninfo, 0, sizeof(m_fbVarScreeninfo));
+    memset(&m_fbFixScreeninfo, 0, sizeof(m_fbFixScreeninfo));
+    m_fbVarScreeninfo.xres = m_fbVarScreeninfo.xres_virtual = width;
+    m_fbVarScreeninfo.yres = m_fbVarScreeninfo.yres_virtual = height;
+    m_fbVarScreeninfo.bits_per_pixel = depth;
+    switch(depth)
+    {
+    case 8:
+        m_fbVarScreeninfo.red = {5, 3, 0};
+        m_fbVarScreeninfo.green = {2, 3, 0};
+        m_fbVarScreeninfo.blue = {0, 2, 0};
+        break;
+    case 16:
+        m_fbVarScreeninfo.red = {11, 5, 0};
+        m_fbVarScreeninfo.green = {5, 6, 0};
+        m_fbVarScreeninfo.blue = {0, 5, 0};
+        break;
+    case 24:
+    case 32:
+        m_fbVarScreeninfo.red = {16, 8, 0};
+        m_fbVarScreeninfo.green = {8, 8, 0};
+        m_fbVarScreeninfo.blue = {0, 8, 0};
+        break;
+    default:
+        m_fbVarScreeninfo.bits_per_pixel = 0; //Unsupported
+    }
+    m_fbFixScreeninfo.type = FB_TYPE_PACKED_PIXELS;
+    m_fbFixScreeninfo.visual = FB_VISUAL_TRUECOLOR;
+    m_fbFixScreeninfo.line_length = width * GetDepth() / 8;
+    m_fbFixScreeninfo.smem_len = m_fbFixScreeninfo.line_length * height;
+    m_pFbmmap = GetDepth() ? new uint8_t[m_fbFixScreeninfo.smem_len]() : NULL; //Zero initialised (black)
+    m_pAtlas = std::make_shared<spriteAtlas>();
+    init("/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf", 16, 16);
+}
+
+void ribanfblib::init(std::string sFontPath, int nFontHeight, int nFontWidth)
+{
+    ClearClip();
+    m_pRecordFile = NULL;
     m_nFtLibInit = -1;
     m_nFtFace = -1;
-    if(FT_Init_FreeType(&m_ftLibrary) == 0)
+    m_bFtLibrary = (FT_Init_FreeType(&m_ftLibrary) == 0);
+    if(m_bFtLibrary)
     {
         if(m_fbFixScreeninfo.type == FB_TYPE_PACKED_PIXELS && // Only support packed pixels
            ((m_fbFixScreeninfo.visual == FB_VISUAL_TRUECOLOR) | (m_fbFixScreeninfo.visual == FB_VISUAL_DIRECTCOLOR))) //Only support truecolor | directcolor
@@ -42,17 +110,27 @@ ribanfblib::ribanfblib(const char* device)
     if(m_nFtLibInit)
         printf("ERROR: Failed to initiate framebuffer - (%dx%d) %dbpp %s %s not supported by this library\n",
                GetWidth(), GetHeight(), GetDepth(), GetType(m_fbFixScreeninfo.type).c_str(), GetVisual(m_fbFixScreeninfo.visual).c_str()); //!@todo Remove this debug message
-    SetFont(16, 16, "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf");
+    //Each instance has its own FreeType library and face because FreeType faces must not be used by more than one thread
+    m_sFontPath = sFontPath;
+    m_nFontHeight = nFontHeight;
+    m_nFontWidth = nFontWidth;
+    SetFont(nFontHeight, nFontWidth, sFontPath);
 }
 
 ribanfblib::~ribanfblib()
 {
-    munmap(m_pFbmmap, m_fbFixScreeninfo.smem_len);
-    close(m_nFbHandle);
-    if(m_nFtLibInit)
+    StopRecording();
+    if(m_nFbHandle >= 0)
+    {
+        munmap(m_pFbmmap, m_fbFixScreeninfo.smem_len);
+        close(m_nFbHandle);
+    }
+    else
+        delete[] m_pFbmmap; //Memory surface
+    if(m_nFtFace == 0)
+        FT_Done_Face(m_ftFace);
+    if(m_bFtLibrary)
         FT_Done_FreeType(m_ftLibrary);
-    for(auto it=m_mmBitmaps.begin(); it != m_mmBitmaps.end(); ++it)
-        delete it->second;
 }
 
 bool ribanfblib::IsReady()
@@ -89,11 +167,96 @@ void ribanfblib::Clear(uint32_t colour)
     }
 }
 
+bool ribanfblib::Composite(ribanfblib& surface, int x, int y)
+{
+    if(!m_pFbmmap || !surface.m_pFbmmap || surface.GetDepth() != GetDepth())
+        return false;
+    int nX1 = std::max(x, m_nClipX1);
+    int nX2 = std::min(x + (int)surface.GetWidth() - 1, m_nClipX2);
+    int nY1 = std::max(y, m_nClipY1);
+    int nY2 = std::min(y + (int)surface.GetHeight() - 1, m_nClipY2);
+    uint32_t nBytes = GetDepth() / 8;
+    for(int nY = nY1; nX1 <= nX2 && nY <= nY2; ++nY)
+        memcpy(m_pFbmmap + nY * m_fbFixScreeninfo.line_length + nX1 * nBytes,
+               surface.m_pFbmmap + (nY - y) * surface.m_fbFixScreeninfo.line_length + (nX1 - x) * nBytes,
+               (nX2 - nX1 + 1) * nBytes);
+    return true;
+}
+
+void ribanfblib::SetClip(int x1, int y1, int x2, int y2)
+{
+    if(x1 > x2)
+        std::swap(x1, x2);
+    if(y1 > y2)
+        std::swap(y1, y2);
+    m_nClipX1 = std::max(x1, 0);
+    m_nClipY1 = std::max(y1, 0);
+    m_nClipX2 = std::min(x2, (int)GetWidth() - 1);
+    m_nClipY2 = std::min(y2, (int)GetHeight() - 1);
+}
+
+void ribanfblib::ClearClip()
+{
+    m_nClipX1 = 0;
+    m_nClipY1 = 0;
+    m_nClipX2 = GetWidth() - 1;
+    m_nClipY2 = GetHeight() - 1;
+}
+
+void ribanfblib::GetClip(int& x1, int& y1, int& x2, int& y2)
+{
+    x1 = m_nClipX1;
+    y1 = m_nClipY1;
+    x2 = m_nClipX2;
+    y2 = m_nClipY2;
+}
+
+void ribanfblib::FillRect(int x1, int y1, int x2, int y2, uint32_t colour)
+{
+    if(!m_pFbmmap)
+        return;
+    if(x1 > x2)
+        std::swap(x1, x2);
+    if(y1 > y2)
+        std::swap(y1, y2);
+    x1 = std::max(x1, m_nClipX1);
+    y1 = std::max(y1, m_nClipY1);
+    x2 = std::min(x2, m_nClipX2);
+    y2 = std::min(y2, m_nClipY2);
+    if(x1 > x2 || y1 > y2)
+        return; //Nothing visible
+    uint32_t nBytes = GetDepth() / 8;
+    uint32_t nCount = x2 - x1 + 1;
+    uint8_t* pFirst = m_pFbmmap + y1 * m_fbFixScreeninfo.line_length + x1 * nBytes;
+    //Paint first row then copy it to subsequent rows
+    switch(GetDepth())
+    {
+    case 32:
+        fbFillSpan32((uint32_t*)pFirst, colour, nCount);
+        break;
+    case 24:
+        for(uint32_t n = 0; n < nCount; ++n)
+        {
+            pFirst[n * 3] = (uint8_t)(colour);
+            pFirst[n * 3 + 1] = (uint8_t)(colour >> 8);
+            pFirst[n * 3 + 2] = (uint8_t)(colour >> 16);
+        }
+        break;
+    case 16:
+        fbFillSpan16((uint16_t*)pFirst, (uint16_t)GetColour(colour), nCount);
+        break;
+    case 8:
+        memset(pFirst, (uint8_t)GetColour(colour), nCount);
+    }
+    for(int nRow = y1 + 1; nRow <= y2; ++nRow)
+        memcpy(m_pFbmmap + nRow * m_fbFixScreeninfo.line_length + x1 * nBytes, pFirst, nCount * nBytes);
+}
+
 void ribanfblib::DrawPixel(uint32_t x, uint32_t y, uint32_t colour)
 {
 //!@todo Would DrawPixel become too inefficient if we calculated each byte for different colour depths?
-    if(x >= GetWidth() || y >= GetHeight())
-        return; //Don't attempt to draw outside framebuffer
+    if((int)x < m_nClipX1 || (int)x > m_nClipX2 || (int)y < m_nClipY1 || (int)y > m_nClipY2)
+        return; //Don't attempt to draw outside framebuffer or clip rectangle
     switch(GetDepth())
     {
     case 32:
@@ -368,13 +531,26 @@ bool ribanfblib::SetFont(int height, int width, std::string path)
         if(m_nFtFace == 0)
             FT_Done_Face(m_ftFace);
         m_nFtFace = FT_New_Face(m_ftLibrary, path.c_str(), 0, &m_ftFace);
+        m_sFontPath = path;
     }
     if(m_nFtFace)
         return false;
     FT_Set_Pixel_Sizes(m_ftFace, width, height);
+    m_nFontHeight = height;
+    m_nFontWidth = width;
     return true;
 }
 
+int ribanfblib::GetFontHeight()
+{
+    return m_nFontHeight;
+}
+
+int ribanfblib::GetFontWidth()
+{
+    return m_nFontWidth;
+}
+
 void ribanfblib::DrawText(std::string text, int x, int y, uint32_t colour, float angle)
 {
     if(m_nFtLibInit || m_nFtFace)
@@ -402,36 +578,270 @@ void ribanfblib::DrawText(std::string text, int x, int y, uint32_t colour, float
     }
 }
 
-bool ribanfblib::LoadBitmap(std::string sFilename, std::string sName)
+int ribanfblib::LoadBitmap(std::string sFilename, uint8_t dither)
+{
+    if(!m_pFbmmap || !m_pAtlas)
+        return -1;
+    if(m_pAtlas.use_count() > 1)
+        return -1; //Atlas is shared - other instances may be reading it and must see the same sprites for each handle
+    bitmap_image image(sFilename);
+    if(!image)
+        return -1; //Failed to load bitmap file
+    if(dither != DITHER_NONE)
+        ditherBitmap(&image, dither);
+    sprite newSprite;
+    newSprite.offset = m_pAtlas->pixels.size();
+    newSprite.width = image.width();
+    newSprite.height = image.height();
+    uint32_t nRowBytes = newSprite.width * GetDepth() / 8;
+    m_pAtlas->pixels.resize(newSprite.offset + nRowBytes * newSprite.height);
+    //bitmap_image rows are BGR so convert directly to framebuffer format
+    for(uint32_t nRow = 0; nRow < newSprite.height; ++nRow)
+        writeRow(image.row(nRow), 3, m_pAtlas->pixels.data() + newSprite.offset + nRow * nRowBytes, newSprite.width);
+    m_pAtlas->sprites.push_back(newSprite);
+    return m_pAtlas->sprites.size() - 1;
+}
+
+void ribanfblib::ditherBitmap(bitmap_image* pImage, uint8_t dither)
+{
+    //8x8 Bayer threshold matrix
+    static const uint8_t anBayer[64] = {
+         0, 32,  8, 40,  2, 34, 10, 42,
+        48, 16, 56, 24, 50, 18, 58, 26,
+        12, 44,  4, 36, 14, 46,  6, 38,
+        60, 28, 52, 20, 62, 30, 54, 22,
+         3, 35, 11, 43,  1, 33,  9, 41,
+        51, 19, 59, 27, 49, 17, 57, 25,
+        15, 47,  7, 39, 13, 45,  5, 37,
+        63, 31, 55, 23, 61, 29, 53, 21};
+    //Floyd-Steinberg kernel: x offset, row offset, weight (in 16ths)
+    static const int anKernel[4][3] = {{1, 0, 7}, {-1, 1, 3}, {0, 1, 5}, {1, 1, 1}};
+
+    uint32_t anLength[3] = {m_fbVarScreeninfo.red.length, m_fbVarScreeninfo.green.length, m_fbVarScreeninfo.blue.length};
+    if(anLength[0] >= 8 && anLength[1] >= 8 && anLength[2] >= 8)
+        return; //No reduction in colour depth
+
+    //Build tables for each component mapping 8-bit value to nearest displayable value and Bayer threshold to offset
+    uint8_t anQuant[3][256];
+    int anOffset[3][64];
+    for(int nComponent = 0; nComponent < 3; ++nComponent)
+    {
+        uint32_t nBits = std::min(std::max(anLength[nComponent], (uint32_t)1), (uint32_t)8);
+        uint32_t nMax = (1 << nBits) - 1;
+        for(int nValue = 0; nValue < 256; ++nValue)
+        {
+            //Replicate level bits to fill 8 bits so the most significant bits, used when drawing, hold the level
+            uint32_t nLevel = (nValue * nMax + 127) / 255;
+            uint32_t nDisplay = 0;
+            for(int nShift = 8 - nBits; nShift > -(int)nBits; nShift -= nBits)
+                nDisplay |= (nShift >= 0) ? (nLevel << nShift) : (nLevel >> -nShift);
+            anQuant[nComponent][nValue] = nDisplay;
+        }
+        for(int nThreshold = 0; nThreshold < 64; ++nThreshold)
+            anOffset[nComponent][nThreshold] = ((2 * nThreshold + 1) * 255 / (int)nMax) / 128 - 255 / (int)nMax / 2;
+    }
+
+    uint32_t nWidth = pImage->width();
+    //Error rows for Floyd-Steinberg (3 components per pixel plus a guard pixel each side), accumulated in 16ths
+    std::vector<int> vError[2];
+    if(dither == DITHER_FLOYD_STEINBERG)
+    {
+        vError[0].assign((nWidth + 2) * 3, 0);
+        vError[1].assign((nWidth + 2) * 3, 0);
+    }
+    for(uint32_t nRow = 0; nRow < pImage->height(); ++nRow)
+    {
+        for(uint32_t nColumn = 0; nColumn < nWidth; ++nColumn)
+        {
+            uint8_t anPixel[3];
+            pImage->get_pixel(nColumn, nRow, anPixel[0], anPixel[1], anPixel[2]);
+            for(int nComponent = 0; nComponent < 3; ++nComponent)
+            {
+                int nValue = anPixel[nComponent];
+                if(dither == DITHER_ORDERED)
+                    nValue += anOffset[nComponent][anBayer[(nRow & 7) * 8 + (nColumn & 7)]];
+                else if(dither == DITHER_FLOYD_STEINBERG)
+                    nValue += vError[0][(nColumn + 1) * 3 + nComponent] / 16;
+                nValue = std::min(std::max(nValue, 0), 255);
+                anPixel[nComponent] = anQuant[nComponent][nValue];
+                if(dither == DITHER_FLOYD_STEINBERG)
+                {
+                    int nError = nValue - anPixel[nComponent];
+                    for(int nTap = 0; nTap < 4; ++nTap)
+                        vError[anKernel[nTap][1]][(nColumn + 1 + anKernel[nTap][0]) * 3 + nComponent] += nError * anKernel[nTap][2];
+                }
+            }
+            pImage->set_pixel(nColumn, nRow, anPixel[0], anPixel[1], anPixel[2]);
+        }
+        if(dither == DITHER_FLOYD_STEINBERG)
+        {
+            vError[0].swap(vError[1]);
+            std::fill(vError[1].begin(), vError[1].end(), 0);
+        }
+    }
+}
+
+bool ribanfblib::DrawSprite(int sprite, int x, int y)
+{
+    if(!m_pFbmmap || !m_pAtlas || sprite < 0 || sprite >= (int)m_pAtlas->sprites.size())
+        return false; //sprite not loaded
+    const struct sprite& item = m_pAtlas->sprites[sprite];
+    int nX1 = std::max(x, m_nClipX1);
+    int nX2 = std::min(x + (int)item.width - 1, m_nClipX2);
+    int nY1 = std::max(y, m_nClipY1);
+    int nY2 = std::min(y + (int)item.height - 1, m_nClipY2);
+    uint32_t nBytes = GetDepth() / 8;
+    const uint8_t* pPixels = m_pAtlas->pixels.data() + item.offset;
+    for(int nY = nY1; nX1 <= nX2 && nY <= nY2; ++nY)
+        memcpy(m_pFbmmap + nY * m_fbFixScreeninfo.line_length + nX1 * nBytes,
+               pPixels + ((nY - y) * item.width + (nX1 - x)) * nBytes,
+               (nX2 - nX1 + 1) * nBytes);
+    return true;
+}
+
+bool ribanfblib::GetSpriteSize(int sprite, uint32_t& width, uint32_t& height)
+{
+    if(!m_pAtlas || sprite < 0 || sprite >= (int)m_pAtlas->sprites.size())
+        return false; //sprite not loaded
+    width = m_pAtlas->sprites[sprite].width;
+    height = m_pAtlas->sprites[sprite].height;
+    return true;
+}
+
+bool ribanfblib::ShareSprites(ribanfblib& source)
 {
-    bitmap_image* pImage =  new bitmap_image(sFilename);
-    if(!pImage)
+    if(source.GetDepth() != GetDepth())
         return false;
-    auto it = m_mmBitmaps.find(sName);
-    if(it != m_mmBitmaps.end())
-        delete it->second;
-    m_mmBitmaps[sName] = pImage;
+    m_pAtlas = source.m_pAtlas;
     return true;
 }
 
-bool ribanfblib::DrawBitmap(std::string sName, int x, int y)
+bool ribanfblib::DrawBitmapFile(std::string sFilename, int x, int y)
 {
-    auto it = m_mmBitmaps.find(sName);
-    if(it == m_mmBitmaps.end())
-        return false; //bitmap not loaded
-    bitmap_image* pImage = it->second;
-    for(unsigned int y = 0; y < pImage->height(); ++y)
-        for(unsigned int x = 0; x < pImage->width(); ++x)
+    if(!m_pFbmmap)
+        return false;
+    int nFile = open(sFilename.c_str(), O_RDONLY);
+    if(nFile < 0)
+        return false;
+    struct stat fileStat;
+    if(fstat(nFile, &fileStat) || fileStat.st_size < 54)
+    {
+        close(nFile);
+        return false; //Too small to hold BMP headers
+    }
+    size_t nFileSize = fileStat.st_size;
+    uint8_t* pFile = (uint8_t*)mmap(0, nFileSize, PROT_READ, MAP_PRIVATE, nFile, 0);
+    close(nFile);
+    if(pFile == MAP_FAILED)
+        return false;
+    madvise(pFile, nFileSize, MADV_SEQUENTIAL);
+
+    //BMP headers are little-endian
+    auto read16 = [pFile](uint32_t nOffset) { return (uint32_t)pFile[nOffset] | (pFile[nOffset + 1] << 8); };
+    auto read32 = [pFile](uint32_t nOffset) { return (uint32_t)pFile[nOffset] | (pFile[nOffset + 1] << 8) | (pFile[nOffset + 2] << 16) | ((uint32_t)pFile[nOffset + 3] << 24); };
+    bool bValid = (pFile[0] == 'B' && pFile[1] == 'M');
+    uint32_t nDataOffset = read32(10);
+    int32_t nWidth = (int32_t)read32(18);
+    int32_t nHeight = (int32_t)read32(22);
+    uint32_t nBpp = read16(28);
+    uint32_t nCompression = read32(30);
+    bool bTopDown = (nHeight < 0);
+    //Limit dimensions before any size arithmetic so nothing below can overflow
+    if(nWidth <= 0 || nWidth > MAX_BITMAP_DIMENSION || nHeight == 0 || nHeight < -MAX_BITMAP_DIMENSION || nHeight > MAX_BITMAP_DIMENSION)
+        bValid = false;
+    if(bTopDown)
+        nHeight = -nHeight;
+    if(nBpp != 24 && nBpp != 32)
+        bValid = false;
+    if(nCompression == 3 && nBpp == 32) //BI_BITFIELDS - only accept the standard BGRX layout
+        bValid &= (nFileSize >= 66 && read32(54) == 0x00FF0000 && read32(58) == 0x0000FF00 && read32(62) == 0x000000FF);
+    else if(nCompression != 0) //Only BI_RGB (uncompressed) is supported
+        bValid = false;
+    uint64_t nStride = (((uint64_t)nWidth * nBpp + 31) / 32) * 4; //Rows are padded to 4 bytes
+    if(bValid && (uint64_t)nDataOffset + nStride * nHeight > nFileSize)
+        bValid = false;
+    if(!bValid)
+    {
+        munmap(pFile, nFileSize);
+        return false;
+    }
+
+    //Clip to clip rectangle
+    int nX1 = std::max(x, m_nClipX1);
+    int nX2 = (int)std::min((int64_t)x + nWidth, (int64_t)m_nClipX2 + 1);
+    uint8_t nSrcBytes = nBpp / 8;
+    uint8_t nDstBytes = GetDepth() / 8;
+    if(nX1 < nX2)
+    {
+        //Iterate in file order so the file is read sequentially
+        for(int nRow = 0; nRow < nHeight; ++nRow)
         {
-            rgb_t colour;
-            pImage->get_pixel(x, y, colour);
-            DrawPixel(x, y, GetColour32(colour));
+            int64_t nY = (int64_t)y + (bTopDown ? nRow : nHeight - 1 - nRow);
+            if(nY < m_nClipY1 || nY > m_nClipY2)
+                continue;
+            const uint8_t* pSrc = pFile + nDataOffset + nRow * nStride + (uint64_t)(nX1 - x) * nSrcBytes;
+            uint8_t* pDst = m_pFbmmap + nY * m_fbFixScreeninfo.line_length + nX1 * nDstBytes;
+            writeRow(pSrc, nSrcBytes, pDst, nX2 - nX1);
         }
+    }
+    munmap(pFile, nFileSize);
     return true;
 }
 
+void ribanfblib::writeRow(const uint8_t* pSrc, uint8_t nSrcBytes, uint8_t* pDst, uint32_t nCount)
+{
+    //Select depth once per row rather than per pixel
+    switch(GetDepth())
+    {
+    case 32:
+        if(nSrcBytes == 4)
+            fbConvertRow32Bgrx(pSrc, (uint32_t*)pDst, nCount);
+        else
+            fbConvertRow32Bgr(pSrc, (uint32_t*)pDst, nCount);
+        break;
+    case 24:
+        for(uint32_t n = 0; n < nCount; ++n, pSrc += nSrcBytes, pDst += 3)
+        {
+            pDst[0] = pSrc[0];
+            pDst[1] = pSrc[1];
+            pDst[2] = pSrc[2];
+        }
+        break;
+    case 16:
+    {
+        fbFormat format = {m_nRedMask, m_nGreenMask, m_nBlueMask, m_nRedShift, m_nGreenShift, m_nBlueShift};
+        if(nSrcBytes == 4)
+            fbConvertRow16Bgrx(pSrc, (uint16_t*)pDst, nCount, format);
+        else
+            fbConvertRow16Bgr(pSrc, (uint16_t*)pDst, nCount, format);
+        break;
+    }
+    case 8:
+        for(uint32_t n = 0; n < nCount; ++n, pSrc += nSrcBytes)
+            pDst[n] = (uint8_t)GetColour(GetColour32(pSrc[2], pSrc[1], pSrc[0]));
+    }
+}
+
 void ribanfblib::drawBitmap(FT_Bitmap* bitmap, int x, int y, uint32_t colour)
 {
+    if(bitmap->pitch > 0 && bitmap->pixel_mode == FT_PIXEL_MODE_MONO && (GetDepth() == 16 || GetDepth() == 32))
+    {
+        //Paint each row clipped to clip rectangle using glyph kernel
+        int nX1 = std::max(x, m_nClipX1);
+        int nX2 = std::min(x + (int)bitmap->width - 1, m_nClipX2);
+        int nY1 = std::max(y, m_nClipY1);
+        int nY2 = std::min(y + (int)bitmap->rows - 1, m_nClipY2);
+        for(int nY = nY1; nX1 <= nX2 && nY <= nY2; ++nY)
+        {
+            const uint8_t* pBits = bitmap->buffer + (nY - y) * bitmap->pitch;
+            uint8_t* pDst = m_pFbmmap + nY * m_fbFixScreeninfo.line_length + nX1 * GetDepth() / 8;
+            if(GetDepth() == 16)
+                fbGlyphRow16(pBits, nX1 - x, (uint16_t*)pDst, nX2 - nX1 + 1, (uint16_t)GetColour(colour));
+            else
+                fbGlyphRow32(pBits, nX1 - x, (uint32_t*)pDst, nX2 - nX1 + 1, colour);
+        }
+        return;
+    }
     int nYmin = 0;
     int nYmax = bitmap->rows;
     int nYdir = 1;
@@ -545,3 +955,166 @@ std::string ribanfblib::GetVisual(uint32_t visual)
   }
   return "Unknown visual";
 }
+
+bool ribanfblib::SaveRaw(std::string sFilename)
+{
+    if(!m_pFbmmap)
+        return false;
+    FILE* pFile = fopen(sFilename.c_str(), "wb");
+    if(!pFile)
+        return false;
+    uint32_t nRowBytes = GetWidth() * GetDepth() / 8;
+    bool bSuccess = true;
+    for(uint32_t nRow = 0; nRow < GetHeight() && bSuccess; ++nRow)
+        bSuccess = (fwrite(m_pFbmmap + nRow * m_fbFixScreeninfo.line_length, nRowBytes, 1, pFile) == 1);
+    fclose(pFile);
+    return bSuccess;
+}
+
+bool ribanfblib::SavePpm(std::string sFilename)
+{
+    if(!m_pFbmmap)
+        return false;
+    FILE* pFile = fopen(sFilename.c_str(), "wb");
+    if(!pFile)
+        return false;
+    fprintf(pFile, "P6\n%u %u\n255\n", GetWidth(), GetHeight());
+    std::vector<uint8_t> vRow(GetWidth() * 3);
+    ribanfbRgbConverter converter(GetDepth(), m_fbVarScreeninfo.red, m_fbVarScreeninfo.green, m_fbVarScreeninfo.blue);
+    bool bSuccess = true;
+    for(uint32_t nRow = 0; nRow < GetHeight() && bSuccess; ++nRow)
+    {
+        converter.Convert(m_pFbmmap + nRow * m_fbFixScreeninfo.line_length, vRow.data(), GetWidth());
+        bSuccess = (fwrite(vRow.data(), vRow.size(), 1, pFile) == 1);
+    }
+    fclose(pFile);
+    return bSuccess;
+}
+
+bool ribanfblib::StartRecording(std::string sFilename)
+{
+    StopRecording();
+    if(!m_pFbmmap)
+        return false;
+    m_pRecordFile = fopen(sFilename.c_str(), "wb");
+    if(!m_pRecordFile)
+        return false;
+    ribanfbRecordHeader header;
+    memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+    header.version = RECORD_VERSION;
+    header.width = GetWidth();
+    header.height = GetHeight();
+    header.depth = GetDepth();
+    header.rowBytes = GetWidth() * GetDepth() / 8;
+    header.red = m_fbVarScreeninfo.red;
+    header.green = m_fbVarScreeninfo.green;
+    header.blue = m_fbVarScreeninfo.blue;
+    if(fwrite(&header, sizeof(header), 1, m_pRecordFile) != 1)
+    {
+        StopRecording();
+        return false;
+    }
+    m_vRecordFrame.clear(); //First frame is recorded in full
+    m_tRecordStart = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool ribanfblib::RecordFrame(int y1, int y2)
+{
+    if(!m_pRecordFile)
+        return false;
+    uint32_t nRowBytes = GetWidth() * GetDepth() / 8;
+    bool bFirst = m_vRecordFrame.empty();
+    if(bFirst)
+    {
+        m_vRecordFrame.resize(nRowBytes * GetHeight());
+        y1 = 0;
+        y2 = -1;
+    }
+    if(y2 < 0 || y2 >= (int)GetHeight())
+        y2 = GetHeight() - 1;
+    y1 = std::max(y1, 0);
+
+    //Find ranges of rows that differ from last recorded frame, updating the copy as we go
+    std::vector<ribanfbRecordRange> vRanges;
+    for(uint32_t nRow = y1; (int)nRow <= y2; ++nRow)
+    {
+        const uint8_t* pRow = m_pFbmmap + nRow * m_fbFixScreeninfo.line_length;
+        uint8_t* pLast = m_vRecordFrame.data() + nRow * nRowBytes;
+        if(!bFirst && memcmp(pRow, pLast, nRowBytes) == 0)
+            continue;
+        memcpy(pLast, pRow, nRowBytes);
+        if(!vRanges.empty() && vRanges.back().first + vRanges.back().count == nRow)
+            ++vRanges.back().count;
+        else
+            vRanges.push_back({nRow, 1});
+    }
+    if(vRanges.empty())
+        return true; //No change
+
+    ribanfbRecordFrame frame;
+    frame.time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_tRecordStart).count();
+    frame.ranges = vRanges.size();
+    bool bSuccess = (fwrite(&frame, sizeof(frame), 1, m_pRecordFile) == 1);
+    for(auto it = vRanges.begin(); it != vRanges.end() && bSuccess; ++it)
+    {
+        bSuccess = (fwrite(&(*it), sizeof(ribanfbRecordRange), 1, m_pRecordFile) == 1);
+        if(bSuccess)
+            bSuccess = (fwrite(m_vRecordFrame.data() + it->first * nRowBytes, nRowBytes * it->count, 1, m_pRecordFile) == 1);
+    }
+    return bSuccess;
+}
+
+void ribanfblib::StopRecording()
+{
+    if(m_pRecordFile)
+        fclose(m_pRecordFile);
+    m_pRecordFile = NULL;
+    m_vRecordFrame.clear();
+    m_vRecordFrame.shrink_to_fit();
+}
+
+ribanfbRgbConverter::ribanfbRgbConverter(uint32_t depth, const fb_bitfield& red, const fb_bitfield& green, const fb_bitfield& blue) :
+    m_nDepth(depth)
+{
+    m_aFields[0] = red;
+    m_aFields[1] = green;
+    m_aFields[2] = blue;
+    //Build tables to expand each component to 8 bits, e.g. 5-bit 31 becomes 255
+    memset(m_anTable, 0, sizeof(m_anTable));
+    for(int nComponent = 0; nComponent < 3; ++nComponent)
+    {
+        uint32_t nMax = (1 << std::min(m_aFields[nComponent].length, (uint32_t)8)) - 1;
+        for(uint32_t nValue = 0; nValue <= nMax; ++nValue)
+            m_anTable[nComponent][nValue] = nMax ? nValue * 255 / nMax : 0;
+    }
+}
+
+void ribanfbRgbConverter::Convert(const uint8_t* pSrc, uint8_t* pDst, uint32_t nCount)
+{
+    const fb_bitfield& red = m_aFields[0];
+    const fb_bitfield& green = m_aFields[1];
+    const fb_bitfield& blue = m_aFields[2];
+    if(m_nDepth == 24 || m_nDepth == 32)
+    {
+        //8-bit components - extract bytes directly
+        uint32_t nBytes = m_nDepth / 8;
+        for(uint32_t n = 0; n < nCount; ++n, pSrc += nBytes, pDst += 3)
+        {
+            pDst[0] = pSrc[red.offset / 8];
+            pDst[1] = pSrc[green.offset / 8];
+            pDst[2] = pSrc[blue.offset / 8];
+        }
+        return;
+    }
+    uint32_t nRedMask = (1 << red.length) - 1;
+    uint32_t nGreenMask = (1 << green.length) - 1;
+    uint32_t nBlueMask = (1 << blue.length) - 1;
+    for(uint32_t n = 0; n < nCount; ++n, pDst += 3)
+    {
+        uint32_t nPixel = (m_nDepth == 16) ? ((const uint16_t*)pSrc)[n] : pSrc[n];
+        pDst[0] = m_anTable[0][(nPixel >> red.offset) & nRedMask];
+        pDst[1] = m_anTable[1][(nPixel >> green.offset) & nGreenMask];
+        pDst[2] = m_anTable[2][(nPixel >> blue.offset) & nBlueMask];
+    }
+}
@@ -9,7 +9,10 @@
 #include "bitmap/bitmap_image.hpp" //Provides bitmap manipulation
 #include <stdint.h> //Provides fixed size int types
 #include <string> //Provides std::string
-#include <map> // Provides std::map
+#include <memory> //Provides std::shared_ptr
+#include <vector> //Provides std::vector
+#include <stdio.h> //Provides FILE
+#include <chrono> //Provides std::chrono::steady_clock
 #include <linux/fb.h> //Provides framebuffer
 #include <ft2build.h> //Provides freetype 2
 #include FT_FREETYPE_H //Macro provides freetype 2 header
@@ -25,6 +28,70 @@
 #define QUADRANT_ALL            0x0F
 #define QUADRANT_NONE           0x00
 #define NO_FILL                 0xFFFFFFFF
+#define DITHER_NONE             0
+#define DITHER_ORDERED          1
+#define DITHER_FLOYD_STEINBERG  2
+#define MAX_BITMAP_DIMENSION    32768
+#define RECORD_MAGIC            "RFBR"
+#define RECORD_VERSION          1
+
+/** Recording file header - recording files are written in host byte order
+*/
+struct ribanfbRecordHeader
+{
+    char magic[4]; //RECORD_MAGIC
+    uint32_t version; //RECORD_VERSION
+    uint32_t width; //Frame width in pixels
+    uint32_t height; //Frame height in pixels
+    uint32_t depth; //Bits per pixel
+    uint32_t rowBytes; //Bytes in each recorded row (width x bytes per pixel)
+    struct fb_bitfield red; //Framebuffer red component format
+    struct fb_bitfield green; //Framebuffer green component format
+    struct fb_bitfield blue; //Framebuffer blue component format
+};
+
+/** Recording frame header - followed by 'ranges' quantity of ribanfbRecordRange
+*/
+struct ribanfbRecordFrame
+{
+    uint32_t time; //Milliseconds since recording started
+    uint32_t ranges; //Quantity of changed row ranges in frame
+};
+
+/** Recording row range header - followed by count x rowBytes of pixel data in framebuffer format
+*/
+struct ribanfbRecordRange
+{
+    uint32_t first; //First row in range
+    uint32_t count; //Quantity of rows in range
+};
+
+/** Class converts rows of pixels from a framebuffer format to 24-bit RGB.
+    Component expansion tables are built once on construction so a converter should be reused for each row of a capture.
+*/
+class ribanfbRgbConverter
+{
+    public:
+        /** @brief  Construct a converter for a framebuffer format
+        *   @param  depth Bits per pixel of source [8 | 16 | 24 | 32]
+        *   @param  red Red component format of source
+        *   @param  green Green component format of source
+        *   @param  blue Blue component format of source
+        */
+        ribanfbRgbConverter(uint32_t depth, const fb_bitfield& red, const fb_bitfield& green, const fb_bitfield& blue);
+
+        /** @brief  Convert a row of pixels from framebuffer format to 24-bit RGB
+        *   @param  pSrc Pointer to source pixels in framebuffer format
+        *   @param  pDst Pointer to destination buffer of at least nCount x 3 bytes
+        *   @param  nCount Quantity of pixels to convert
+        */
+        void Convert(const uint8_t* pSrc, uint8_t* pDst, uint32_t nCount);
+
+    protected:
+        uint32_t m_nDepth; //Bits per pixel of source
+        fb_bitfield m_aFields[3]; //Red, green, blue component formats of source
+        uint8_t m_anTable[3][256]; //Expansion of each component value to 8 bits
+};
 
 extern "C" {
 
@@ -37,6 +104,9 @@ extern "C" {
     Text rendering uses FreeType library to access supported fonts including TrueType. Size and rotation is implemented.
     Single functions for each fundamental shape are provided which allow the border thickness and internal fill colour to be specified.
     Supported framebuffer formats: packed pixels, truecolor, directcolor.
+    Each instance holds its own drawing state (clip, font, FreeType library) so separate instances may be used by separate threads.
+    Memory surfaces may be created with the same format as a framebuffer, drawn by worker threads in parallel and then composited
+    into the framebuffer. Loaded bitmaps (sprites) are immutable and may be shared between instances.
 */
 class ribanfblib
 {
@@ -46,6 +116,27 @@ class ribanfblib
         */
         ribanfblib(const char* device = "/dev/fb0");
 
+        /** @brief  Instantiate a surface in memory
+        *   @param  format Framebuffer object to copy colour format, font and sprites from
+        *   @param  width Surface width in pixels
+        *   @param  height Surface height in pixels
+        *   @note   Surface is initially black. Use Composite() on the framebuffer object to copy surface to screen.
+        *   @note   Create surfaces before worker threads start drawing to the format object, e.g. create all surfaces at start-up
+        */
+        ribanfblib(ribanfblib& format, uint32_t width, uint32_t height);
+
+        /** @brief  Instantiate a surface in memory without a framebuffer device
+        *   @param  width Surface width in pixels
+        *   @param  height Surface height in pixels
+        *   @param  depth Colour depth in bits per pixel [8 (RGB332) | 16 (RGB565) | 24 (RGB888) | 32 (XRGB8888)]
+        *   @note   Surface is initially black. Useful for off-screen rendering and for testing without a display.
+        *   @note   Unsupported depth results in a surface that does not draw
+        */
+        ribanfblib(uint32_t width, uint32_t height, uint32_t depth);
+
+        ribanfblib(const ribanfblib&) = delete;
+        ribanfblib& operator=(const ribanfblib&) = delete;
+
         /** @brief  Destroy the framebuffer object
         */
         virtual ~ribanfblib();
@@ -75,6 +166,48 @@ class ribanfblib
         */
         void Clear(uint32_t colour = BLACK);
 
+        /** @brief  Restrict drawing to a rectangle
+        *   @param  x1 The horizontal offset of the top left from left edge of screen
+        *   @param  y1 The vertical offset of the top left from top edge of screen
+        *   @param  x2 The horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 The vertical offset of the bottom right from top edge of screen
+        *   @note   Clip rectangle is inclusive and is limited to the screen. Pixels outside the clip rectangle are not drawn.
+        */
+        void SetClip(int x1, int y1, int x2, int y2);
+
+        /** @brief  Remove clip rectangle, allowing drawing to whole screen
+        */
+        void ClearClip();
+
+        /** @brief  Get the clip rectangle
+        *   @param  x1 Populated with the horizontal offset of the top left from left edge of screen
+        *   @param  y1 Populated with the vertical offset of the top left from top edge of screen
+        *   @param  x2 Populated with the horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 Populated with the vertical offset of the bottom right from top edge of screen
+        *   @note   Whole screen is returned if no clip rectangle is set
+        */
+        void GetClip(int& x1, int& y1, int& x2, int& y2);
+
+        /** @brief  Fill a rectangle with a solid colour
+        *   @param  x1 The horizontal offset of the top left from left edge of screen
+        *   @param  y1 The vertical offset of the top left from top edge of screen
+        *   @param  x2 The horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 The vertical offset of the bottom right from top edge of screen
+        *   @param  colour Fill colour [Default: Black]
+        *   @note   Faster than DrawRect for solid fills because each row is written as a single span
+        */
+        void FillRect(int x1, int y1, int x2, int y2, uint32_t colour = BLACK);
+
+        /** @brief  Copy a surface to this framebuffer
+        *   @param  surface Surface to copy from (must have same colour depth)
+        *   @param  x The horizontal offset of the top left of surface from left edge of screen
+        *   @param  y The vertical offset of the top left of surface from top edge of screen
+        *   @retval bool True on success
+        *   @note   Only the target's clip rectangle is read so threads may composite non-overlapping surfaces concurrently without locking,
+        *           provided no thread changes the target's clip rectangle at the same time
+        */
+        bool Composite(ribanfblib& surface, int x, int y);
+
         /** @brief  Draw a single pixel
         *   @param  x The horizontal offset from left edge of screen
         *   @param  y The vertical offset from top edge of screen
@@ -137,6 +270,16 @@ class ribanfblib
         */
         bool SetFont(int height, int width = 0, std::string path = "");
 
+        /** @brief  Get the height of the current font
+        *   @retval int Font height in pixels
+        */
+        int GetFontHeight();
+
+        /** @brief  Get the width of the current font
+        *   @retval int Font width in pixels (0 if same as height)
+        */
+        int GetFontWidth();
+
         /** @brief  Draw text in currently selected font
         *   @param  sText Text to draw
         *   @param  x1 The horizontal offset of bottom left from left edge of screen
@@ -147,20 +290,50 @@ class ribanfblib
         */
         void DrawText(std::string sText, int x, int y, uint32_t colour = WHITE, float angle = 0);
 
-	/** @brief Load a bitmap into memory
-	*   @param sFilename Full path and filename of bitmap file to load
-	*   @param sName Name to use to refer to bitmap
-	*   @retval bool True on success
-	*/
-	bool LoadBitmap(std::string sFilename, std::string sName);
-
-	/** @brief Draw bitmap
-	*   @param sName Name of a preloaded bitmap
-	*   @param x X coordinate of top left corner
-	*   @param y Y coordinate of top left corner
-	*   @retval bool True on success
-	*/
-	bool DrawBitmap(std::string sName, int x, int y);
+        /** @brief  Load a bitmap into the sprite atlas
+        *   @param  sFilename Full path and filename of bitmap file to load
+        *   @param  dither Dithering applied when reducing to framebuffer colour depth [DITHER_NONE | DITHER_ORDERED | DITHER_FLOYD_STEINBERG] [Default: DITHER_NONE]
+        *   @retval int Sprite handle or -1 on failure
+        *   @note   Bitmap is converted to framebuffer format once when loaded and stored with all other sprites in a single contiguous block of memory
+        *   @note   Fails if the atlas is shared with another instance (a memory surface or ShareSprites). Load all sprites before sharing.
+        *   @note   Dithering is applied once at load so has no cost when drawing. It has no effect on 24 & 32-bit framebuffers.
+        */
+        int LoadBitmap(std::string sFilename, uint8_t dither = DITHER_NONE);
+
+        /** @brief  Draw a sprite
+        *   @param  sprite Sprite handle returned by LoadBitmap
+        *   @param  x X coordinate of top left corner
+        *   @param  y Y coordinate of top left corner
+        *   @retval bool True on success
+        */
+        bool DrawSprite(int sprite, int x, int y);
+
+        /** @brief  Get the dimensions of a sprite
+        *   @param  sprite Sprite handle returned by LoadBitmap
+        *   @param  width Populated with sprite width in pixels
+        *   @param  height Populated with sprite height in pixels
+        *   @retval bool True on success
+        */
+        bool GetSpriteSize(int sprite, uint32_t& width, uint32_t& height);
+
+        /** @brief  Share sprites loaded by another instance
+        *   @param  source Instance to share sprites from (must have same colour depth)
+        *   @retval bool True on success
+        *   @note   Replaces sprites loaded in this instance. Both instances reference the same atlas so each sprite handle refers to the same image in both.
+        *   @note   Neither instance may load further bitmaps while the atlas is shared
+        */
+        bool ShareSprites(ribanfblib& source);
+
+        /** @brief  Draw a bitmap file directly to the framebuffer without loading it into memory
+        *   @param  sFilename Full path and filename of bitmap file to draw
+        *   @param  x X coordinate of top left corner
+        *   @param  y Y coordinate of top left corner
+        *   @retval bool True on success
+        *   @note   File is memory mapped and decoded one row at a time so memory use is constant regardless of image size
+        *   @note   Supports uncompressed 24-bit and 32-bit BMP files. Rows are painted in file order (bottom-up for most files)
+        *   @note   Files wider or taller than MAX_BITMAP_DIMENSION pixels are rejected
+        */
+        bool DrawBitmapFile(std::string sFilename, int x, int y);
 
         /** @brief  Get a colour value based on the specified colour depth
         *   @param  red Red component
@@ -211,19 +384,61 @@ class ribanfblib
         */
         static std::string GetVisual(uint32_t visual);
 
+        /** @brief  Save the current screen to a file in framebuffer format
+        *   @param  sFilename Full path and filename of file to create
+        *   @retval bool True on success
+        *   @note   Only visible pixels are saved, i.e. GetHeight() rows of GetWidth() x GetDepth() / 8 bytes
+        */
+        bool SaveRaw(std::string sFilename);
+
+        /** @brief  Save the current screen to a PPM (portable pixmap) file
+        *   @param  sFilename Full path and filename of file to create
+        *   @retval bool True on success
+        */
+        bool SavePpm(std::string sFilename);
+
+        /** @brief  Start recording screen changes to a file
+        *   @param  sFilename Full path and filename of file to create
+        *   @retval bool True on success
+        *   @note   Call RecordFrame() to append each frame. Only rows that changed since the previous frame are stored.
+        *   @see    tools/fbreplay to reconstruct frames from a recording
+        */
+        bool StartRecording(std::string sFilename);
+
+        /** @brief  Append changes since the last recorded frame to recording
+        *   @param  y1 First row that may have changed [Default: 0]
+        *   @param  y2 Last row that may have changed [Default: -1 for last row of screen]
+        *   @retval bool True on success
+        *   @note   Frames with no changes are not written
+        *   @note   Only rows y1..y2 are compared with the last frame. Rows outside are assumed unchanged so pass the rows drawn since the last frame, e.g. from ribanfbscene::GetRenderedRows(), to avoid scanning the whole screen. The first frame is always recorded in full.
+        */
+        bool RecordFrame(int y1 = 0, int y2 = -1);
+
+        /** @brief  Stop recording and close recording file
+        */
+        void StopRecording();
+
     protected:
 
     private:
+        void init(std::string sFontPath, int nFontHeight, int nFontWidth); //Initialise colour format, FreeType and default font
         void drawBitmap(FT_Bitmap* bitmap, int x, int y, uint32_t colour);
+        void ditherBitmap(bitmap_image* pImage, uint8_t dither); //Quantize bitmap to framebuffer colour depth with dithering
+        void writeRow(const uint8_t* pSrc, uint8_t nSrcBytes, uint8_t* pDst, uint32_t nCount); //Convert a row of BGR(A) pixels to framebuffer format
         int drawChar(char c, int x, int y, int colour); //low level draw character from font, returns x coord of next character
         void drawLine(int x1, int y1, int x2, int y2, uint32_t colour); //Bresenham's line algorithm
         void drawQuadrant(int x0, int y0, uint32_t radius, uint32_t colour, uint8_t border, uint8_t quadrant = QUADRANT_ALL); //Draw each circle quadrant indicated by 4-bit (LSB) of quadrant
 
+        int m_nClipX1; //Left edge of clip rectangle
+        int m_nClipY1; //Top edge of clip rectangle
+        int m_nClipX2; //Right edge of clip rectangle (inclusive)
+        int m_nClipY2; //Bottom edge of clip rectangle (inclusive)
+
         int m_nLineLength; //Bytes in each line of framebuffer memory map (width x bbp)
         struct fb_var_screeninfo m_fbVarScreeninfo; //Framebuffer variable sceen info structure
         struct fb_fix_screeninfo m_fbFixScreeninfo; //Framebuffer fixed sceen info structure
-        uint8_t* m_pFbmmap; //Pointer to framebuffer memory map
-        int m_nFbHandle; //File handle for framebuffer device
+        uint8_t* m_pFbmmap; //Pointer to framebuffer memory map (or memory of surface)
+        int m_nFbHandle; //File handle for framebuffer device (-1 for memory surface)
 
         uint32_t m_nRedMask; //32-bit mask for red colour component
         uint32_t m_nGreenMask; //32-bit mask for green colour component
@@ -236,8 +451,29 @@ class ribanfblib
         FT_Face m_ftFace; //Freetype typeface
         int m_nFtLibInit; // 0 if Freetype library successfully initialised
         int m_nFtFace; // 0 if Freetype typeface loaded
-
-	std::map<std::string,bitmap_image*> m_mmBitmaps; // Map of loaded bitmaps
+        bool m_bFtLibrary; //True if Freetype library needs to be released
+        std::string m_sFontPath; //Path of current font
+        int m_nFontHeight; //Height of current font
+        int m_nFontWidth; //Width of current font
+
+        struct sprite
+        {
+            size_t offset; //Offset of first pixel in atlas
+            uint32_t width; //Width in pixels
+            uint32_t height; //Height in pixels
+        };
+
+        struct spriteAtlas
+        {
+            std::vector<uint8_t> pixels; //Pixels of all sprites in framebuffer format, each sprite's rows packed consecutively
+            std::vector<sprite> sprites; //Sprites indexed by handle
+        };
+
+        std::shared_ptr<spriteAtlas> m_pAtlas; //Sprite atlas (read only while shared with other instances)
+
+        FILE* m_pRecordFile; //Recording file (NULL if not recording)
+        std::vector<uint8_t> m_vRecordFrame; //Copy of last recorded frame
+        std::chrono::steady_clock::time_point m_tRecordStart; //Time recording started
 };
 
 }
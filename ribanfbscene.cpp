@@ -0,0 +1,317 @@
+/*  Retained scene for simple framebuffer graphics library
+    Copyright:  riban 2019
+    Author:     Brian Walotn (brian@riban.co.uk)
+    License:    LGPL
+*/
+#include "ribanfbscene.h"
+#include <algorithm> //Provides std::min, std::max, std::stable_sort
+
+ribanfbscene::ribanfbscene(ribanfblib& fb, uint32_t background) :
+    m_fb(fb),
+    m_nBackground(background),
+    m_nDamageCount(0),
+    m_nRenderedY1(0),
+    m_nRenderedY2(-1)
+{
+    DamageAll();
+}
+
+ribanfbscene::~ribanfbscene()
+{
+}
+
+uint32_t ribanfbscene::AddRect(int x1, int y1, int x2, int y2, uint32_t colour, uint8_t border, uint32_t fillColour, int z)
+{
+    node newNode = node();
+    newNode.type = NODE_RECT;
+    newNode.bounds = {std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2)};
+    newNode.z = z;
+    newNode.colour = colour;
+    newNode.border = border;
+    newNode.fillColour = fillColour;
+    return addNode(newNode);
+}
+
+uint32_t ribanfbscene::AddText(std::string sText, int x, int y, uint32_t width, uint32_t fontHeight, uint32_t colour, int z)
+{
+    node newNode = node();
+    newNode.type = NODE_TEXT;
+    newNode.bounds = {x, y - (int)fontHeight, x + (int)width - 1, y + (int)fontHeight / 4};
+    newNode.z = z;
+    newNode.colour = colour;
+    newNode.fontHeight = fontHeight;
+    newNode.text = sText;
+    return addNode(newNode);
+}
+
+uint32_t ribanfbscene::AddBitmap(int sprite, int x, int y, int z)
+{
+    uint32_t nWidth, nHeight;
+    if(!m_fb.GetSpriteSize(sprite, nWidth, nHeight) || !nWidth || !nHeight)
+        return INVALID_NODE; //sprite not loaded
+    node newNode = node();
+    newNode.type = NODE_BITMAP;
+    newNode.bounds = {x, y, x + (int)nWidth - 1, y + (int)nHeight - 1};
+    newNode.z = z;
+    newNode.sprite = sprite;
+    return addNode(newNode);
+}
+
+uint32_t ribanfbscene::AddGauge(int x1, int y1, int x2, int y2, float value, uint32_t colour, uint32_t background, int z)
+{
+    node newNode = node();
+    newNode.type = NODE_GAUGE;
+    newNode.bounds = {std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2)};
+    newNode.z = z;
+    newNode.colour = colour;
+    newNode.fillColour = background;
+    newNode.value = std::min(std::max(value, 0.0f), 1.0f);
+    return addNode(newNode);
+}
+
+void ribanfbscene::Remove(uint32_t node)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type == NODE_NONE)
+        return;
+    damage(m_vNodes[node].bounds);
+    m_vNodes[node].type = NODE_NONE;
+    m_vNodes[node].text.clear();
+    sortNodes();
+}
+
+void ribanfbscene::SetPosition(uint32_t node, int x, int y)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type == NODE_NONE)
+        return;
+    rect& bounds = m_vNodes[node].bounds;
+    if(bounds.x1 == x && bounds.y1 == y)
+        return;
+    damage(bounds);
+    bounds.x2 += x - bounds.x1;
+    bounds.y2 += y - bounds.y1;
+    bounds.x1 = x;
+    bounds.y1 = y;
+    damage(bounds);
+}
+
+void ribanfbscene::SetZ(uint32_t node, int z)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type == NODE_NONE || m_vNodes[node].z == z)
+        return;
+    m_vNodes[node].z = z;
+    damage(m_vNodes[node].bounds);
+    sortNodes();
+}
+
+void ribanfbscene::SetVisible(uint32_t node, bool visible)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type == NODE_NONE || m_vNodes[node].visible == visible)
+        return;
+    m_vNodes[node].visible = visible;
+    damage(m_vNodes[node].bounds);
+}
+
+void ribanfbscene::SetColour(uint32_t node, uint32_t colour)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type == NODE_NONE || m_vNodes[node].colour == colour)
+        return;
+    m_vNodes[node].colour = colour;
+    damage(m_vNodes[node].bounds);
+}
+
+void ribanfbscene::SetText(uint32_t node, std::string sText)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type != NODE_TEXT || m_vNodes[node].text == sText)
+        return;
+    m_vNodes[node].text = sText;
+    damage(m_vNodes[node].bounds);
+}
+
+void ribanfbscene::SetValue(uint32_t node, float value)
+{
+    if(node >= m_vNodes.size() || m_vNodes[node].type != NODE_GAUGE)
+        return;
+    struct node& gauge = m_vNodes[node];
+    int nOldEdge = gaugeEdge(gauge);
+    gauge.value = std::min(std::max(value, 0.0f), 1.0f);
+    int nNewEdge = gaugeEdge(gauge);
+    if(nOldEdge != nNewEdge)
+        damage({std::min(nOldEdge, nNewEdge) + 1, gauge.bounds.y1, std::max(nOldEdge, nNewEdge), gauge.bounds.y2}); //Only the columns that change
+}
+
+void ribanfbscene::Damage(int x1, int y1, int x2, int y2)
+{
+    damage({std::min(x1, x2), std::min(y1, y2), std::max(x1, x2), std::max(y1, y2)});
+}
+
+void ribanfbscene::DamageAll()
+{
+    damage({0, 0, (int)m_fb.GetWidth() - 1, (int)m_fb.GetHeight() - 1});
+}
+
+bool ribanfbscene::IsDamaged()
+{
+    return !m_vDamage.empty();
+}
+
+uint32_t ribanfbscene::GetDamageCount()
+{
+    return m_nDamageCount;
+}
+
+std::chrono::steady_clock::time_point ribanfbscene::GetDamageTime()
+{
+    return m_tDamage;
+}
+
+uint32_t ribanfbscene::Render()
+{
+    uint32_t nPixels = 0;
+    int nClipX1, nClipY1, nClipX2, nClipY2;
+    m_fb.GetClip(nClipX1, nClipY1, nClipX2, nClipY2); //Restored after rendering so the caller's clip is preserved
+    m_nRenderedY1 = 0;
+    m_nRenderedY2 = -1;
+    for(auto itDamage = m_vDamage.begin(); itDamage != m_vDamage.end(); ++itDamage)
+    {
+        const rect& area = *itDamage;
+        if(m_nRenderedY1 > m_nRenderedY2)
+        {
+            m_nRenderedY1 = area.y1;
+            m_nRenderedY2 = area.y2;
+        }
+        else
+        {
+            m_nRenderedY1 = std::min(m_nRenderedY1, area.y1);
+            m_nRenderedY2 = std::max(m_nRenderedY2, area.y2);
+        }
+        m_fb.SetClip(area.x1, area.y1, area.x2, area.y2);
+        m_fb.FillRect(area.x1, area.y1, area.x2, area.y2, m_nBackground);
+        for(auto itNode = m_vOrder.begin(); itNode != m_vOrder.end(); ++itNode)
+        {
+            const node& item = m_vNodes[*itNode];
+            if(!item.visible)
+                continue;
+            //Clip to the intersection of damage and node so nodes never paint outside their bounds
+            rect clip = {std::max(area.x1, item.bounds.x1), std::max(area.y1, item.bounds.y1),
+                         std::min(area.x2, item.bounds.x2), std::min(area.y2, item.bounds.y2)};
+            if(clip.x1 > clip.x2 || clip.y1 > clip.y2)
+                continue; //Node not in damaged area
+            m_fb.SetClip(clip.x1, clip.y1, clip.x2, clip.y2);
+            drawNode(item);
+        }
+        nPixels += (area.x2 - area.x1 + 1) * (area.y2 - area.y1 + 1);
+    }
+    m_fb.SetClip(nClipX1, nClipY1, nClipX2, nClipY2);
+    m_vDamage.clear();
+    return nPixels;
+}
+
+bool ribanfbscene::GetRenderedRows(int& y1, int& y2)
+{
+    if(m_nRenderedY1 > m_nRenderedY2)
+        return false;
+    y1 = m_nRenderedY1;
+    y2 = m_nRenderedY2;
+    return true;
+}
+
+uint32_t ribanfbscene::addNode(node& newNode)
+{
+    newNode.visible = true;
+    uint32_t nHandle = 0;
+    //Reuse a removed node's slot if available
+    while(nHandle < m_vNodes.size() && m_vNodes[nHandle].type != NODE_NONE)
+        ++nHandle;
+    if(nHandle < m_vNodes.size())
+        m_vNodes[nHandle] = newNode;
+    else
+        m_vNodes.push_back(newNode);
+    damage(newNode.bounds);
+    sortNodes();
+    return nHandle;
+}
+
+void ribanfbscene::damage(const rect& area)
+{
+    //Limit to screen
+    rect merged = {std::max(area.x1, 0), std::max(area.y1, 0),
+                   std::min(area.x2, (int)m_fb.GetWidth() - 1), std::min(area.y2, (int)m_fb.GetHeight() - 1)};
+    if(merged.x1 > merged.x2 || merged.y1 > merged.y2)
+        return; //Off screen
+    ++m_nDamageCount;
+    if(m_vDamage.empty())
+        m_tDamage = std::chrono::steady_clock::now();
+    //Merge with any overlapping or adjacent areas, repeating until no more overlap
+    for(size_t n = 0; n < m_vDamage.size();)
+    {
+        const rect& existing = m_vDamage[n];
+        if(existing.x1 > merged.x2 + 1 || existing.x2 + 1 < merged.x1 || existing.y1 > merged.y2 + 1 || existing.y2 + 1 < merged.y1)
+        {
+            ++n;
+            continue;
+        }
+        merged = {std::min(existing.x1, merged.x1), std::min(existing.y1, merged.y1),
+                  std::max(existing.x2, merged.x2), std::max(existing.y2, merged.y2)};
+        m_vDamage.erase(m_vDamage.begin() + n);
+        n = 0;
+    }
+    if(m_vDamage.size() >= MAX_DAMAGE_RECTS)
+    {
+        //Too many separate areas - collapse to a single bounding rectangle
+        for(auto it = m_vDamage.begin(); it != m_vDamage.end(); ++it)
+            merged = {std::min(it->x1, merged.x1), std::min(it->y1, merged.y1),
+                      std::max(it->x2, merged.x2), std::max(it->y2, merged.y2)};
+        m_vDamage.clear();
+    }
+    m_vDamage.push_back(merged);
+}
+
+void ribanfbscene::drawNode(const node& item)
+{
+    const rect& bounds = item.bounds;
+    switch(item.type)
+    {
+    case NODE_RECT:
+        if(item.border)
+            m_fb.DrawRect(bounds.x1, bounds.y1, bounds.x2, bounds.y2, item.colour, item.border, item.fillColour);
+        else if(item.fillColour != NO_FILL)
+            m_fb.FillRect(bounds.x1, bounds.y1, bounds.x2, bounds.y2, item.fillColour);
+        break;
+    case NODE_TEXT:
+    {
+        //Restore the caller's font size after drawing
+        int nFontHeight = m_fb.GetFontHeight();
+        int nFontWidth = m_fb.GetFontWidth();
+        m_fb.SetFont(item.fontHeight);
+        m_fb.DrawText(item.text, bounds.x1, bounds.y1 + item.fontHeight, item.colour);
+        m_fb.SetFont(nFontHeight, nFontWidth);
+        break;
+    }
+    case NODE_BITMAP:
+        m_fb.DrawSprite(item.sprite, bounds.x1, bounds.y1);
+        break;
+    case NODE_GAUGE:
+    {
+        int nEdge = gaugeEdge(item);
+        if(nEdge >= bounds.x1)
+            m_fb.FillRect(bounds.x1, bounds.y1, nEdge, bounds.y2, item.colour);
+        if(nEdge < bounds.x2)
+            m_fb.FillRect(nEdge + 1, bounds.y1, bounds.x2, bounds.y2, item.fillColour);
+        break;
+    }
+    }
+}
+
+int ribanfbscene::gaugeEdge(const node& item)
+{
+    return item.bounds.x1 + (int)(item.value * (item.bounds.x2 - item.bounds.x1 + 1)) - 1;
+}
+
+void ribanfbscene::sortNodes()
+{
+    m_vOrder.clear();
+    for(uint32_t nHandle = 0; nHandle < m_vNodes.size(); ++nHandle)
+        if(m_vNodes[nHandle].type != NODE_NONE)
+            m_vOrder.push_back(nHandle);
+    std::stable_sort(m_vOrder.begin(), m_vOrder.end(), [this](uint32_t a, uint32_t b) { return m_vNodes[a].z < m_vNodes[b].z; });
+}
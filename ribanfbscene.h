@@ -0,0 +1,216 @@
+/*  Retained scene for simple framebuffer graphics library
+    Copyright:  riban 2019
+    Author:     Brian Walotn (brian@riban.co.uk)
+    License:    LGPL
+*/
+#pragma once
+
+#include "ribanfblib.h" //Provides framebuffer drawing
+#include <stdint.h> //Provides fixed size int types
+#include <string> //Provides std::string
+#include <vector> //Provides std::vector
+#include <chrono> //Provides std::chrono::steady_clock
+
+#define NODE_NONE               0
+#define NODE_RECT               1
+#define NODE_TEXT               2
+#define NODE_BITMAP             3
+#define NODE_GAUGE              4
+#define MAX_DAMAGE_RECTS        16
+#define INVALID_NODE            0xFFFFFFFF
+
+/** Class provides a retained set of graphic elements (nodes) drawn to a ribanfblib framebuffer.
+    Each node has rectangular bounds and a z-order. Nodes with higher z are drawn above nodes with lower z.
+    Changing a node marks its bounds as damaged. Render() redraws only the nodes that intersect damaged areas,
+    clipped to those areas, so a small change costs only the pixels it affects rather than a full screen redraw.
+    Node handles are returned when a node is added and remain valid until the node is removed.
+*/
+class ribanfbscene
+{
+    public:
+        /** @brief  Instantiate a scene
+        *   @param  fb Framebuffer to draw to
+        *   @param  background Colour painted behind all nodes [Default: Black]
+        */
+        ribanfbscene(ribanfblib& fb, uint32_t background = BLACK);
+
+        /** @brief  Destroy the scene
+        */
+        virtual ~ribanfbscene();
+
+        /** @brief  Add a rectangle node
+        *   @param  x1 The horizontal offset of the top left from left edge of screen
+        *   @param  y1 The vertical offset of the top left from top edge of screen
+        *   @param  x2 The horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 The vertical offset of the bottom right from top edge of screen
+        *   @param  colour The colour of the border [Default: White]
+        *   @param  border The thickness of the border in pixels [Default: 1]
+        *   @param  fillColour The colour to fill the shape with [Default: no fill]
+        *   @param  z Z-order [Default: 0]
+        *   @retval uint32_t Node handle
+        */
+        uint32_t AddRect(int x1, int y1, int x2, int y2, uint32_t colour = WHITE, uint8_t border = 1, uint32_t fillColour = NO_FILL, int z = 0);
+
+        /** @brief  Add a text node
+        *   @param  sText Text to draw
+        *   @param  x The horizontal offset of bottom left of text from left edge of screen
+        *   @param  y The vertical offset of bottom left of text from top edge of screen
+        *   @param  width Width of the text area in pixels
+        *   @param  fontHeight Height of font in pixels
+        *   @param  colour Foreground colour [Default: White]
+        *   @param  z Z-order [Default: 0]
+        *   @retval uint32_t Node handle
+        *   @note   Bounds extend from fontHeight above the baseline to a quarter of fontHeight below (for descenders). Text is clipped to bounds.
+        *   @note   Text is drawn in the framebuffer's current font face at fontHeight. The framebuffer's font size is restored after drawing.
+        */
+        uint32_t AddText(std::string sText, int x, int y, uint32_t width, uint32_t fontHeight, uint32_t colour = WHITE, int z = 0);
+
+        /** @brief  Add a bitmap node
+        *   @param  sprite Sprite handle returned by ribanfblib::LoadBitmap
+        *   @param  x X coordinate of top left corner
+        *   @param  y Y coordinate of top left corner
+        *   @param  z Z-order [Default: 0]
+        *   @retval uint32_t Node handle or INVALID_NODE if sprite not loaded
+        */
+        uint32_t AddBitmap(int sprite, int x, int y, int z = 0);
+
+        /** @brief  Add a horizontal bar gauge node
+        *   @param  x1 The horizontal offset of the top left from left edge of screen
+        *   @param  y1 The vertical offset of the top left from top edge of screen
+        *   @param  x2 The horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 The vertical offset of the bottom right from top edge of screen
+        *   @param  value Proportion of gauge filled (0..1)
+        *   @param  colour Colour of filled portion [Default: Green]
+        *   @param  background Colour of unfilled portion [Default: Dark grey]
+        *   @param  z Z-order [Default: 0]
+        *   @retval uint32_t Node handle
+        */
+        uint32_t AddGauge(int x1, int y1, int x2, int y2, float value, uint32_t colour = GREEN, uint32_t background = DARK_GREY, int z = 0);
+
+        /** @brief  Remove a node
+        *   @param  node Node handle
+        */
+        void Remove(uint32_t node);
+
+        /** @brief  Move a node
+        *   @param  node Node handle
+        *   @param  x New horizontal offset of top left of node bounds
+        *   @param  y New vertical offset of top left of node bounds
+        */
+        void SetPosition(uint32_t node, int x, int y);
+
+        /** @brief  Change the z-order of a node
+        *   @param  node Node handle
+        *   @param  z Z-order
+        */
+        void SetZ(uint32_t node, int z);
+
+        /** @brief  Show or hide a node
+        *   @param  node Node handle
+        *   @param  visible True to show node
+        */
+        void SetVisible(uint32_t node, bool visible);
+
+        /** @brief  Change the foreground colour of a node
+        *   @param  node Node handle
+        *   @param  colour New colour (border of rect, text colour or filled portion of gauge)
+        */
+        void SetColour(uint32_t node, uint32_t colour);
+
+        /** @brief  Change the text of a text node
+        *   @param  node Node handle
+        *   @param  sText New text
+        */
+        void SetText(uint32_t node, std::string sText);
+
+        /** @brief  Change the value of a gauge node
+        *   @param  node Node handle
+        *   @param  value Proportion of gauge filled (0..1)
+        *   @note   Only the part of the gauge that changes is damaged
+        */
+        void SetValue(uint32_t node, float value);
+
+        /** @brief  Mark an area of the screen as needing to be redrawn
+        *   @param  x1 The horizontal offset of the top left from left edge of screen
+        *   @param  y1 The vertical offset of the top left from top edge of screen
+        *   @param  x2 The horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 The vertical offset of the bottom right from top edge of screen
+        *   @note   Overlapping areas are merged
+        */
+        void Damage(int x1, int y1, int x2, int y2);
+
+        /** @brief  Mark the whole screen as needing to be redrawn
+        */
+        void DamageAll();
+
+        /** @brief  Check if any area needs to be redrawn
+        *   @retval bool True if there is damage pending
+        */
+        bool IsDamaged();
+
+        /** @brief  Get the quantity of areas damaged since the scene was created
+        *   @retval uint32_t Damage count (wraps at 2^32)
+        *   @note   Each node change counts once for each area it damages, e.g. moving a node damages its old and new bounds. Changes entirely off screen are not counted.
+        */
+        uint32_t GetDamageCount();
+
+        /** @brief  Get the time that the oldest pending damage was added
+        *   @retval time_point Time of first damage since last render (undefined if no damage pending)
+        */
+        std::chrono::steady_clock::time_point GetDamageTime();
+
+        /** @brief  Redraw damaged areas
+        *   @retval uint32_t Quantity of pixels redrawn
+        */
+        uint32_t Render();
+
+        /** @brief  Get the range of rows redrawn by the last Render()
+        *   @param  y1 Populated with first row redrawn
+        *   @param  y2 Populated with last row redrawn
+        *   @retval bool True if any rows were redrawn
+        *   @note   Pass to ribanfblib::RecordFrame() so only redrawn rows are compared when recording
+        */
+        bool GetRenderedRows(int& y1, int& y2);
+
+    protected:
+
+    private:
+        struct rect
+        {
+            int x1;
+            int y1;
+            int x2;
+            int y2;
+        };
+
+        struct node
+        {
+            uint8_t type; //Node type [NODE_NONE | NODE_RECT | NODE_TEXT | NODE_BITMAP | NODE_GAUGE]
+            rect bounds; //Bounding rectangle (inclusive)
+            int z; //Z-order
+            bool visible; //True to draw node
+            uint32_t colour; //Foreground colour
+            uint32_t fillColour; //Fill / background colour
+            uint8_t border; //Border thickness
+            uint32_t fontHeight; //Font height of text node
+            float value; //Gauge value (0..1)
+            int sprite; //Sprite handle of bitmap node
+            std::string text; //Text of text node
+        };
+
+        uint32_t addNode(node& newNode); //Add node to scene and return its handle
+        void damage(const rect& area); //Add area to damage list, merging overlapping areas
+        void drawNode(const node& item); //Draw a node (clip must already be set)
+        int gaugeEdge(const node& item); //Get the x coordinate of the last filled column of a gauge
+        void sortNodes(); //Rebuild draw order
+
+        ribanfblib& m_fb; //Framebuffer to draw to
+        uint32_t m_nBackground; //Background colour
+        std::vector<node> m_vNodes; //Nodes indexed by handle
+        std::vector<uint32_t> m_vOrder; //Node handles in draw order (ascending z)
+        std::vector<rect> m_vDamage; //Areas needing redraw
+        std::chrono::steady_clock::time_point m_tDamage; //Time first damage was added since last render
+        uint32_t m_nDamageCount; //Quantity of areas damaged since scene was created
+        int m_nRenderedY1; //First row redrawn by last render
+        int m_nRenderedY2; //Last row redrawn by last render (less than m_nRenderedY1 if nothing redrawn)
+};
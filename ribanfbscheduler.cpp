@@ -0,0 +1,179 @@
+/*  Frame scheduler for simple framebuffer graphics library
+    Copyright:  riban 2019
+    Author:     Brian Walotn (brian@riban.co.uk)
+    License:    LGPL
+*/
+#include "ribanfbscheduler.h"
+#include <algorithm> //Provides std::nth_element, std::min
+#include <thread> //Provides std::this_thread::sleep_until
+
+using namespace std::chrono;
+
+ribanfbscheduler::ribanfbscheduler(ribanfbscene& scene, float rate) :
+    m_scene(scene)
+{
+    SetTargetRate(rate);
+    m_tNextFrame = steady_clock::now();
+    m_nDamageCount = scene.GetDamageCount();
+    ResetMetrics();
+}
+
+ribanfbscheduler::~ribanfbscheduler()
+{
+}
+
+void ribanfbscheduler::SetTargetRate(float rate)
+{
+    if(rate > 0)
+        m_period = microseconds((int64_t)(1000000 / rate));
+    else
+        m_period = microseconds(0);
+}
+
+float ribanfbscheduler::GetTargetRate()
+{
+    if(m_period.count() == 0)
+        return 0;
+    return 1000000.0f / m_period.count();
+}
+
+void ribanfbscheduler::Invalidate(int x1, int y1, int x2, int y2)
+{
+    m_scene.Damage(x1, y1, x2, y2);
+}
+
+void ribanfbscheduler::NotifyInput(steady_clock::time_point time)
+{
+    if(!m_bInput || time < m_tInput)
+        m_tInput = time;
+    m_bInput = true;
+}
+
+bool ribanfbscheduler::Tick()
+{
+    steady_clock::time_point tNow = steady_clock::now();
+    if(tNow < m_tNextFrame)
+        return false; //Frame not yet due
+    if(!m_scene.IsDamaged())
+    {
+        //Nothing to draw - skip this frame slot
+        if(m_period.count())
+        {
+            ++m_nSkipped;
+            m_tNextFrame = tNow + m_period;
+        }
+        discardPending();
+        return false;
+    }
+    return render();
+}
+
+bool ribanfbscheduler::RenderNow()
+{
+    if(!m_scene.IsDamaged())
+    {
+        discardPending();
+        return false;
+    }
+    return render();
+}
+
+void ribanfbscheduler::Wait()
+{
+    if(m_period.count() == 0)
+        return;
+    std::this_thread::sleep_until(m_tNextFrame);
+}
+
+uint32_t ribanfbscheduler::GetFrameCount()
+{
+    return m_nFrames;
+}
+
+uint32_t ribanfbscheduler::GetSkippedCount()
+{
+    return m_nSkipped;
+}
+
+uint32_t ribanfbscheduler::GetCoalescedCount()
+{
+    return m_nCoalesced;
+}
+
+uint32_t ribanfbscheduler::GetLastRenderTime()
+{
+    return m_nLastRenderTime;
+}
+
+uint32_t ribanfbscheduler::GetRenderTime(uint8_t percentile)
+{
+    return ribanfbscheduler::percentile(m_vRenderTimes, percentile);
+}
+
+uint32_t ribanfbscheduler::GetLatency(uint8_t percentile)
+{
+    return ribanfbscheduler::percentile(m_vLatencies, percentile);
+}
+
+void ribanfbscheduler::ResetMetrics()
+{
+    m_bInput = false;
+    m_nFrames = 0;
+    m_nSkipped = 0;
+    m_nCoalesced = 0;
+    m_nLastRenderTime = 0;
+    m_nSample = 0;
+    m_vRenderTimes.clear();
+    m_vLatencies.clear();
+    m_vRenderTimes.reserve(METRIC_SAMPLES);
+    m_vLatencies.reserve(METRIC_SAMPLES);
+}
+
+bool ribanfbscheduler::render()
+{
+    steady_clock::time_point tInput = m_scene.GetDamageTime();
+    if(m_bInput && m_tInput < tInput)
+        tInput = m_tInput;
+    steady_clock::time_point tStart = steady_clock::now();
+    m_scene.Render();
+    steady_clock::time_point tEnd = steady_clock::now();
+
+    m_nLastRenderTime = duration_cast<microseconds>(tEnd - tStart).count();
+    uint32_t nLatency = duration_cast<microseconds>(tEnd - tInput).count();
+    if(m_vRenderTimes.size() < METRIC_SAMPLES)
+    {
+        m_vRenderTimes.push_back(m_nLastRenderTime);
+        m_vLatencies.push_back(nLatency);
+    }
+    else
+    {
+        m_vRenderTimes[m_nSample] = m_nLastRenderTime;
+        m_vLatencies[m_nSample] = nLatency;
+    }
+    m_nSample = (m_nSample + 1) % METRIC_SAMPLES;
+
+    ++m_nFrames;
+    m_nCoalesced += m_scene.GetDamageCount() - m_nDamageCount;
+    m_nDamageCount = m_scene.GetDamageCount();
+    m_bInput = false;
+    if(m_period.count())
+        m_tNextFrame = tStart + m_period;
+    return true;
+}
+
+void ribanfbscheduler::discardPending()
+{
+    //Input that caused no damage produces no frame so must not be carried into the latency of a later frame
+    m_nDamageCount = m_scene.GetDamageCount();
+    m_bInput = false;
+}
+
+uint32_t ribanfbscheduler::percentile(const std::vector<uint32_t>& samples, uint8_t percentile)
+{
+    if(samples.empty())
+        return 0;
+    std::vector<uint32_t> vSorted(samples);
+    size_t nIndex = std::min((size_t)(vSorted.size() * std::min(percentile, (uint8_t)100) / 100), vSorted.size() - 1);
+    std::nth_element(vSorted.begin(), vSorted.begin() + nIndex, vSorted.end());
+    return vSorted[nIndex];
+}
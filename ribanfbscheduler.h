@@ -0,0 +1,131 @@
+/*  Frame scheduler for simple framebuffer graphics library
+    Copyright:  riban 2019
+    Author:     Brian Walotn (brian@riban.co.uk)
+    License:    LGPL
+*/
+#pragma once
+
+#include "ribanfbscene.h" //Provides retained scene
+#include <stdint.h> //Provides fixed size int types
+#include <vector> //Provides std::vector
+#include <chrono> //Provides std::chrono::steady_clock
+
+#define METRIC_SAMPLES          256
+
+/** Class provides frame based rendering of a ribanfbscene.
+    Changes made to the scene between frames are collected and coalesced by the scene's damage list.
+    Tick() renders at most one frame per frame period (or immediately if target rate is 0) and skips frames with no damage.
+    Input-to-present latency and render time of recent frames are recorded so percentiles may be reported.
+    Times are in microseconds.
+*/
+class ribanfbscheduler
+{
+    public:
+        /** @brief  Instantiate a frame scheduler
+        *   @param  scene Scene to render
+        *   @param  rate Target frame rate in frames per second, 0 to render on demand [Default: 30]
+        */
+        ribanfbscheduler(ribanfbscene& scene, float rate = 30);
+
+        /** @brief  Destroy the frame scheduler
+        */
+        virtual ~ribanfbscheduler();
+
+        /** @brief  Set the target frame rate
+        *   @param  rate Frames per second, 0 to render as soon as there is damage
+        */
+        void SetTargetRate(float rate);
+
+        /** @brief  Get the target frame rate
+        *   @retval float Frames per second (0 for on demand)
+        */
+        float GetTargetRate();
+
+        /** @brief  Mark an area as needing to be redrawn in the next frame
+        *   @param  x1 The horizontal offset of the top left from left edge of screen
+        *   @param  y1 The vertical offset of the top left from top edge of screen
+        *   @param  x2 The horizontal offset of the bottom right from left edge of screen
+        *   @param  y2 The vertical offset of the bottom right from top edge of screen
+        */
+        void Invalidate(int x1, int y1, int x2, int y2);
+
+        /** @brief  Record the time of an input event that will result in a change to the scene
+        *   @param  time Time of input event [Default: now]
+        *   @note   Latency is measured from the oldest input (or scene damage if earlier) since the last frame
+        *   @note   Input that has not damaged the scene by the next Tick() is discarded and does not count towards latency
+        */
+        void NotifyInput(std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now());
+
+        /** @brief  Render a frame if one is due and there is damage
+        *   @retval bool True if a frame was rendered
+        */
+        bool Tick();
+
+        /** @brief  Render a frame now if there is damage, regardless of target rate
+        *   @retval bool True if a frame was rendered
+        */
+        bool RenderNow();
+
+        /** @brief  Sleep until the next frame is due
+        *   @note   Returns immediately if target rate is 0 or a frame is already due
+        */
+        void Wait();
+
+        /** @brief  Get the quantity of frames rendered
+        *   @retval uint32_t Frames rendered since metrics were reset
+        */
+        uint32_t GetFrameCount();
+
+        /** @brief  Get the quantity of frames skipped because there was no damage
+        *   @retval uint32_t Frames skipped since metrics were reset
+        */
+        uint32_t GetSkippedCount();
+
+        /** @brief  Get the quantity of scene changes merged into rendered frames
+        *   @retval uint32_t Areas damaged (by node changes, ribanfbscene::Damage or Invalidate) and drawn since metrics were reset
+        *   @see    ribanfbscene::GetDamageCount for how changes are counted
+        */
+        uint32_t GetCoalescedCount();
+
+        /** @brief  Get the render time of the last frame
+        *   @retval uint32_t Render time in microseconds
+        */
+        uint32_t GetLastRenderTime();
+
+        /** @brief  Get a percentile of render time over recent frames
+        *   @param  percentile Percentile (0..100), e.g. 50 for median, 99 for near worst case
+        *   @retval uint32_t Render time in microseconds (0 if no frames rendered)
+        */
+        uint32_t GetRenderTime(uint8_t percentile);
+
+        /** @brief  Get a percentile of input-to-present latency over recent frames
+        *   @param  percentile Percentile (0..100)
+        *   @retval uint32_t Latency in microseconds (0 if no frames rendered)
+        */
+        uint32_t GetLatency(uint8_t percentile);
+
+        /** @brief  Reset frame counts and discard recorded times
+        */
+        void ResetMetrics();
+
+    protected:
+
+    private:
+        bool render(); //Render a frame and record metrics
+        void discardPending(); //Clear pending input and damage count when a frame is skipped
+        static uint32_t percentile(const std::vector<uint32_t>& samples, uint8_t percentile); //Calculate percentile of samples
+
+        ribanfbscene& m_scene; //Scene to render
+        std::chrono::microseconds m_period; //Frame period (0 for on demand)
+        std::chrono::steady_clock::time_point m_tNextFrame; //Earliest time next frame may be rendered
+        std::chrono::steady_clock::time_point m_tInput; //Time of oldest input since last frame
+        bool m_bInput; //True if an input has been notified since last frame
+        uint32_t m_nFrames; //Quantity of frames rendered
+        uint32_t m_nSkipped; //Quantity of frames skipped
+        uint32_t m_nCoalesced; //Quantity of scene changes merged into frames
+        uint32_t m_nDamageCount; //Scene damage count at last frame
+        uint32_t m_nLastRenderTime; //Render time of last frame
+        std::vector<uint32_t> m_vRenderTimes; //Ring buffer of recent render times
+        std::vector<uint32_t> m_vLatencies; //Ring buffer of recent latencies
+        uint32_t m_nSample; //Index of next sample in ring buffers
+};
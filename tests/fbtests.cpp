@@ -0,0 +1,641 @@
+/*  Headless tests for riban Framebuffer Library
+    Copyright riban 2019
+    Author: Brian Walton brian@riban.co.uk
+
+    Draws to memory surfaces so no display is required.
+    Usage: fbtests [path to fbreplay]
+    Returns 0 if all tests pass. Run with "make check".
+*/
+
+#include "../ribanfblib.h"
+#include "../ribanfbscene.h"
+#include "../ribanfbscheduler.h"
+#include "../ribanfbkernels.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <thread>
+
+using namespace std::chrono;
+
+static int g_nFailures = 0;
+static std::string g_sTmpDir;
+
+#define CHECK(condition) \
+    do { if(!(condition)) { fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #condition); ++g_nFailures; } } while(0)
+
+/** @brief  Read a file into a buffer
+*   @param  sFilename Full path and filename
+*   @retval vector File content (empty on failure)
+*/
+std::vector<uint8_t> readFile(std::string sFilename)
+{
+    std::vector<uint8_t> vData;
+    FILE* pFile = fopen(sFilename.c_str(), "rb");
+    if(!pFile)
+        return vData;
+    uint8_t anBuffer[4096];
+    size_t nRead;
+    while((nRead = fread(anBuffer, 1, sizeof(anBuffer), pFile)) > 0)
+        vData.insert(vData.end(), anBuffer, anBuffer + nRead);
+    fclose(pFile);
+    return vData;
+}
+
+/** @brief  Get the value of a pixel on a 16-bit surface
+*   @param  fb Surface
+*   @param  x Column
+*   @param  y Row
+*   @retval uint32_t Pixel value in surface format
+*/
+uint32_t getPixel(ribanfblib& fb, uint32_t x, uint32_t y)
+{
+    std::string sFilename = g_sTmpDir + "/pixels.raw";
+    fb.SaveRaw(sFilename);
+    std::vector<uint8_t> vRaw = readFile(sFilename);
+    size_t nOffset = (y * fb.GetWidth() + x) * 2;
+    if(nOffset + 1 >= vRaw.size())
+        return 0xFFFFFFFF;
+    return vRaw[nOffset] | (vRaw[nOffset + 1] << 8);
+}
+
+/** @brief  Write an uncompressed BMP file
+*   @param  sFilename Full path and filename
+*   @param  nWidth Width in pixels
+*   @param  nHeight Height in pixels
+*   @param  pColours Function returning 24-bit RGB colour of each pixel
+*   @param  nBpp Bits per pixel [24 | 32] [Default: 24]
+*   @param  bTopDown True to store rows top-down (negative height) [Default: false]
+*/
+void writeBmp(std::string sFilename, uint32_t nWidth, uint32_t nHeight, uint32_t (*pColours)(uint32_t, uint32_t),
+              uint32_t nBpp = 24, bool bTopDown = false)
+{
+    uint32_t nBytes = nBpp / 8;
+    uint32_t nStride = (nWidth * nBytes + 3) & ~3;
+    std::vector<uint8_t> vFile(54 + nStride * nHeight, 0);
+    auto write32 = [&vFile](uint32_t nOffset, uint32_t nValue) { for(int n = 0; n < 4; ++n) vFile[nOffset + n] = nValue >> (8 * n); };
+    vFile[0] = 'B';
+    vFile[1] = 'M';
+    write32(2, vFile.size());
+    write32(10, 54);
+    write32(14, 40);
+    write32(18, nWidth);
+    write32(22, bTopDown ? -(int32_t)nHeight : nHeight);
+    vFile[26] = 1;
+    vFile[28] = nBpp;
+    for(uint32_t nY = 0; nY < nHeight; ++nY)
+        for(uint32_t nX = 0; nX < nWidth; ++nX)
+        {
+            uint32_t nColour = pColours(nX, nY);
+            uint32_t nRow = bTopDown ? nY : nHeight - 1 - nY;
+            uint8_t* pPixel = &vFile[54 + nRow * nStride + nX * nBytes]; //BGR or BGRX
+            pPixel[0] = nColour;
+            pPixel[1] = nColour >> 8;
+            pPixel[2] = nColour >> 16;
+        }
+    FILE* pFile = fopen(sFilename.c_str(), "wb");
+    if(pFile)
+    {
+        fwrite(vFile.data(), vFile.size(), 1, pFile);
+        fclose(pFile);
+    }
+}
+
+/** @brief  Colour of each pixel of the dithering test image - horizontal grey gradient */
+uint32_t greyGradient(uint32_t x, uint32_t y)
+{
+    return ribanfblib::GetColour32(x, x, x);
+}
+
+/** @brief  Colour of each pixel of the test sprite - unique per pixel so position can be verified */
+uint32_t spriteColour(uint32_t x, uint32_t y)
+{
+    return ribanfblib::GetColour32(x * 32, y * 32, 0x80);
+}
+
+void testMemorySurface()
+{
+    ribanfblib fb(20, 10, 16);
+    CHECK(fb.IsReady());
+    CHECK(fb.GetWidth() == 20 && fb.GetHeight() == 10 && fb.GetDepth() == 16);
+    CHECK(getPixel(fb, 19, 9) == fb.GetColour(BLACK)); //Initially black
+    fb.FillRect(2, 3, 4, 5, RED);
+    CHECK(getPixel(fb, 3, 4) == fb.GetColour(RED));
+    CHECK(getPixel(fb, 5, 4) == fb.GetColour(BLACK));
+    fb.Clear(WHITE);
+    CHECK(getPixel(fb, 0, 0) == fb.GetColour(WHITE));
+
+    ribanfblib fb32(4, 4, 32);
+    CHECK(fb32.GetDepth() == 32 && fb32.GetColour(RED) == 0xFF0000);
+    ribanfblib fb8(4, 4, 8);
+    CHECK(fb8.GetDepth() == 8 && fb8.GetColour(WHITE) == 0xFF);
+
+    ribanfblib unsupported(4, 4, 12);
+    CHECK(!unsupported.SaveRaw(g_sTmpDir + "/unsupported.raw")); //No pixels to save
+}
+
+void testSceneDamage()
+{
+    ribanfblib fb(64, 32, 16);
+    CHECK(fb.IsReady());
+    ribanfbscene scene(fb);
+    CHECK(scene.Render() == 64 * 32); //Initial render is whole screen
+    CHECK(scene.Render() == 0); //Nothing changed
+    CHECK(!scene.IsDamaged());
+
+    uint32_t nRect = scene.AddRect(10, 10, 19, 19, RED, 0, RED);
+    CHECK(scene.IsDamaged());
+    CHECK(scene.Render() == 100); //Only the new rectangle
+    CHECK(getPixel(fb, 15, 15) == fb.GetColour(RED));
+    CHECK(getPixel(fb, 9, 15) == fb.GetColour(BLACK));
+
+    scene.SetPosition(nRect, 12, 10); //Old and new bounds overlap so merge
+    CHECK(scene.Render() == 12 * 10);
+    CHECK(getPixel(fb, 10, 15) == fb.GetColour(BLACK));
+    CHECK(getPixel(fb, 21, 15) == fb.GetColour(RED));
+
+    scene.Damage(0, 0, 1, 1);
+    scene.Damage(60, 30, 61, 31); //Separate areas are not merged
+    CHECK(scene.Render() == 8);
+    int nY1, nY2;
+    CHECK(scene.GetRenderedRows(nY1, nY2) && nY1 == 0 && nY2 == 31);
+    scene.Render();
+    CHECK(!scene.GetRenderedRows(nY1, nY2));
+
+    //Rendering text must not change the caller's font
+    fb.SetFont(20);
+    scene.AddText("riban", 0, 30, 40, 10);
+    scene.Render();
+    CHECK(fb.GetFontHeight() == 20);
+
+    //Rendering must not change the caller's clip
+    int nX1, nX2;
+    fb.SetClip(5, 6, 40, 20);
+    scene.Damage(0, 0, 63, 31);
+    scene.Render();
+    fb.GetClip(nX1, nY1, nX2, nY2);
+    CHECK(nX1 == 5 && nY1 == 6 && nX2 == 40 && nY2 == 20);
+    fb.ClearClip();
+    fb.GetClip(nX1, nY1, nX2, nY2);
+    CHECK(nX1 == 0 && nY1 == 0 && nX2 == 63 && nY2 == 31);
+}
+
+void testGaugePartialRedraw()
+{
+    ribanfblib fb(64, 8, 16);
+    ribanfbscene scene(fb);
+    uint32_t nGauge = scene.AddGauge(0, 0, 63, 7, 0.5, GREEN, BLUE);
+    scene.Render();
+    CHECK(getPixel(fb, 31, 4) == fb.GetColour(GREEN));
+    CHECK(getPixel(fb, 32, 4) == fb.GetColour(BLUE));
+
+    scene.SetValue(nGauge, 0.75);
+    CHECK(scene.Render() == 16 * 8); //Only the columns that changed
+    CHECK(getPixel(fb, 47, 4) == fb.GetColour(GREEN));
+    CHECK(getPixel(fb, 48, 4) == fb.GetColour(BLUE));
+
+    scene.SetValue(nGauge, 0.75);
+    CHECK(scene.Render() == 0); //No change
+
+    scene.SetValue(nGauge, 0);
+    CHECK(scene.Render() == 48 * 8);
+    CHECK(getPixel(fb, 0, 4) == fb.GetColour(BLUE));
+    scene.SetValue(nGauge, 1);
+    CHECK(scene.Render() == 64 * 8);
+    CHECK(getPixel(fb, 63, 4) == fb.GetColour(GREEN));
+}
+
+void testSchedulerSkip()
+{
+    ribanfblib fb(16, 16, 16);
+    ribanfbscene scene(fb);
+    ribanfbscheduler scheduler(scene, 1000);
+    scheduler.RenderNow(); //Initial full screen
+    scheduler.ResetMetrics();
+
+    scheduler.Wait();
+    CHECK(!scheduler.Tick()); //No damage
+    CHECK(scheduler.GetSkippedCount() == 1);
+    CHECK(scheduler.GetFrameCount() == 0);
+
+    //Several invalidations are coalesced into one frame
+    scheduler.Invalidate(0, 0, 1, 1);
+    scheduler.Invalidate(4, 4, 5, 5);
+    scheduler.Wait();
+    CHECK(scheduler.Tick());
+    CHECK(scheduler.GetFrameCount() == 1);
+    CHECK(scheduler.GetCoalescedCount() == 2);
+
+    //Input that does not damage the scene is discarded when the frame is skipped
+    scheduler.ResetMetrics();
+    scheduler.NotifyInput(steady_clock::now() - seconds(1));
+    scheduler.Wait();
+    CHECK(!scheduler.Tick());
+    scheduler.Invalidate(0, 0, 1, 1);
+    scheduler.Wait();
+    CHECK(scheduler.Tick());
+    CHECK(scheduler.GetLatency(100) < 500000);
+    CHECK(scheduler.GetCoalescedCount() == 1);
+
+    //Changes made through scene setters are counted, input without damage is not
+    scheduler.ResetMetrics();
+    uint32_t nGauge = scene.AddGauge(0, 0, 15, 3, 0);
+    for(int nValue = 1; nValue <= 4; ++nValue)
+        scene.SetValue(nGauge, nValue * 0.25f);
+    scheduler.NotifyInput();
+    scheduler.Wait();
+    CHECK(scheduler.Tick());
+    CHECK(scheduler.GetCoalescedCount() == 5);
+    scheduler.NotifyInput();
+    scheduler.Wait();
+    CHECK(!scheduler.Tick());
+    CHECK(scheduler.GetCoalescedCount() == 5);
+}
+
+void testSchedulerPercentiles()
+{
+    ribanfblib fb(16, 16, 16);
+    ribanfbscene scene(fb);
+    ribanfbscheduler scheduler(scene, 0);
+    scheduler.RenderNow();
+    scheduler.ResetMetrics();
+    CHECK(scheduler.GetLatency(50) == 0); //No samples
+
+    //Latencies of 10, 20 .. 100ms
+    for(int nFrame = 1; nFrame <= 10; ++nFrame)
+    {
+        scheduler.NotifyInput(steady_clock::now() - milliseconds(nFrame * 10));
+        scheduler.Invalidate(0, 0, 1, 1);
+        CHECK(scheduler.RenderNow());
+    }
+    CHECK(scheduler.GetFrameCount() == 10);
+    CHECK(scheduler.GetLatency(0) >= 10000 && scheduler.GetLatency(0) < 20000);
+    CHECK(scheduler.GetLatency(50) >= 60000 && scheduler.GetLatency(50) < 70000);
+    CHECK(scheduler.GetLatency(100) >= 100000 && scheduler.GetLatency(100) < 110000);
+    CHECK(scheduler.GetRenderTime(50) <= scheduler.GetRenderTime(100));
+}
+
+void testRecordReplay(std::string sReplay)
+{
+    ribanfblib fb(40, 30, 16);
+    std::string sRecording = g_sTmpDir + "/recording.rfbr";
+    CHECK(fb.StartRecording(sRecording));
+    fb.FillRect(0, 0, 39, 29, BLUE);
+    CHECK(fb.RecordFrame());
+    CHECK(fb.RecordFrame()); //Unchanged frame is skipped
+    fb.FillRect(5, 10, 20, 12, RED);
+    fb.DrawLine(0, 29, 39, 0, GREEN);
+    CHECK(fb.RecordFrame());
+    fb.StopRecording();
+    CHECK(fb.SavePpm(g_sTmpDir + "/expected.ppm"));
+
+    std::string sCommand = sReplay + " " + sRecording + " " + g_sTmpDir + "/frame > /dev/null";
+    CHECK(system(sCommand.c_str()) == 0);
+    std::vector<uint8_t> vExpected = readFile(g_sTmpDir + "/expected.ppm");
+    CHECK(!vExpected.empty());
+    CHECK(readFile(g_sTmpDir + "/frame00001.ppm") == vExpected);
+    CHECK(readFile(g_sTmpDir + "/frame00000.ppm") != vExpected);
+    CHECK(access((g_sTmpDir + "/frame00002.ppm").c_str(), F_OK) != 0); //Unchanged frame not recorded
+}
+
+void testRecordHint()
+{
+    ribanfblib fb(40, 30, 16);
+    ribanfbscene scene(fb);
+    scene.Render();
+    std::string sRecording = g_sTmpDir + "/hint.rfbr";
+    CHECK(fb.StartRecording(sRecording));
+    CHECK(fb.RecordFrame(5, 5)); //First frame is recorded in full regardless of hint
+
+    //Only rows within the hint are compared
+    scene.AddRect(0, 2, 39, 5, RED, 0, RED);
+    scene.Render();
+    fb.FillRect(0, 20, 39, 21, GREEN); //Outside hint so not recorded
+    int nY1, nY2;
+    CHECK(scene.GetRenderedRows(nY1, nY2) && nY1 == 2 && nY2 == 5);
+    CHECK(fb.RecordFrame(nY1, nY2));
+    fb.StopRecording();
+    size_t nRowBytes = 40 * 2;
+    size_t nFrameSize = sizeof(ribanfbRecordFrame) + sizeof(ribanfbRecordRange);
+    CHECK(readFile(sRecording).size() == sizeof(ribanfbRecordHeader) + nFrameSize + 30 * nRowBytes + nFrameSize + 4 * nRowBytes);
+}
+
+void testSpriteClipping()
+{
+    std::string sBitmap = g_sTmpDir + "/sprite.bmp";
+    writeBmp(sBitmap, 4, 4, spriteColour);
+    ribanfblib fb(8, 8, 16);
+    int nSprite = fb.LoadBitmap(sBitmap);
+    CHECK(nSprite == 0);
+    uint32_t nWidth, nHeight;
+    CHECK(fb.GetSpriteSize(nSprite, nWidth, nHeight) && nWidth == 4 && nHeight == 4);
+    CHECK(!fb.DrawSprite(1, 0, 0)); //Invalid handle
+
+    //Partly off the top left
+    CHECK(fb.DrawSprite(nSprite, -2, -2));
+    CHECK(getPixel(fb, 0, 0) == fb.GetColour(spriteColour(2, 2)));
+    CHECK(getPixel(fb, 1, 1) == fb.GetColour(spriteColour(3, 3)));
+    CHECK(getPixel(fb, 2, 2) == fb.GetColour(BLACK));
+
+    //Partly off the bottom right
+    CHECK(fb.DrawSprite(nSprite, 6, 6));
+    CHECK(getPixel(fb, 7, 7) == fb.GetColour(spriteColour(1, 1)));
+    CHECK(getPixel(fb, 5, 5) == fb.GetColour(BLACK));
+
+    //Clip rectangle
+    fb.Clear();
+    fb.SetClip(3, 3, 4, 4);
+    CHECK(fb.DrawSprite(nSprite, 2, 2));
+    fb.ClearClip();
+    CHECK(getPixel(fb, 3, 3) == fb.GetColour(spriteColour(1, 1)));
+    CHECK(getPixel(fb, 4, 4) == fb.GetColour(spriteColour(2, 2)));
+    CHECK(getPixel(fb, 2, 2) == fb.GetColour(BLACK));
+    CHECK(getPixel(fb, 5, 5) == fb.GetColour(BLACK));
+
+    //Surfaces share the atlas so handles mean the same image and no more bitmaps may be loaded
+    ribanfblib surface(fb, 8, 8);
+    CHECK(surface.GetSpriteSize(nSprite, nWidth, nHeight) && nWidth == 4);
+    CHECK(fb.LoadBitmap(sBitmap) == -1);
+    CHECK(surface.LoadBitmap(sBitmap) == -1);
+}
+
+void testBitmapFileLimits()
+{
+    //Width that would wrap a 32-bit stride to zero must be rejected
+    std::string sBitmap = g_sTmpDir + "/huge.bmp";
+    writeBmp(sBitmap, 1, 1, spriteColour);
+    std::vector<uint8_t> vFile = readFile(sBitmap);
+    vFile[28] = 32;
+    vFile[18] = vFile[19] = vFile[20] = 0;
+    vFile[21] = 0x08; //Width 0x08000000
+    FILE* pFile = fopen(sBitmap.c_str(), "wb");
+    fwrite(vFile.data(), vFile.size(), 1, pFile);
+    fclose(pFile);
+    ribanfblib fb(8, 8, 32);
+    CHECK(!fb.DrawBitmapFile(sBitmap, 0, 0));
+
+    writeBmp(sBitmap, 4, 4, spriteColour);
+    CHECK(fb.DrawBitmapFile(sBitmap, 6, 6)); //Partly off screen
+}
+
+void testBitmapFileMatchesSprite()
+{
+    //Streaming a file must produce the same pixels as loading it as a sprite, for each file layout, depth and clipping offset
+    std::string sSprite = g_sTmpDir + "/sprite.bmp";
+    writeBmp(sSprite, 7, 5, spriteColour);
+    const std::string asFiles[3] = {g_sTmpDir + "/bottomup24.bmp", g_sTmpDir + "/topdown24.bmp", g_sTmpDir + "/bottomup32.bmp"};
+    writeBmp(asFiles[0], 7, 5, spriteColour);
+    writeBmp(asFiles[1], 7, 5, spriteColour, 24, true);
+    writeBmp(asFiles[2], 7, 5, spriteColour, 32);
+    const int anOffsets[3] = {-3, 0, 5};
+    const uint32_t anDepths[4] = {8, 16, 24, 32};
+    std::string sRaw = g_sTmpDir + "/compare.raw";
+    for(uint32_t nDepth : anDepths)
+    {
+        ribanfblib fb(12, 10, nDepth);
+        CHECK(fb.IsReady());
+        int nSprite = fb.LoadBitmap(sSprite);
+        CHECK(nSprite >= 0);
+        for(int nX : anOffsets)
+            for(int nY : anOffsets)
+            {
+                fb.Clear();
+                fb.DrawSprite(nSprite, nX, nY);
+                fb.SaveRaw(sRaw);
+                std::vector<uint8_t> vExpected = readFile(sRaw);
+                CHECK(!vExpected.empty());
+                for(const std::string& sFile : asFiles)
+                {
+                    fb.Clear();
+                    CHECK(fb.DrawBitmapFile(sFile, nX, nY));
+                    fb.SaveRaw(sRaw);
+                    if(readFile(sRaw) != vExpected)
+                    {
+                        fprintf(stderr, "%s at %d bpp offset %d,%d differs from sprite\n", sFile.c_str(), nDepth, nX, nY);
+                        CHECK(false);
+                    }
+                }
+            }
+    }
+}
+
+void testKernels()
+{
+    //Compare each kernel with a simple per-pixel implementation across lengths and bit offsets that exercise vector and remainder paths
+    fbFormat format = {0xF80000, 0x00FC00, 0x0000F8, 8, 5, 3}; //RGB565
+    std::vector<uint8_t> vSrc(4 * 70);
+    for(size_t n = 0; n < vSrc.size(); ++n)
+        vSrc[n] = n * 37 + 11;
+    const uint8_t anBits[10] = {0xA5, 0xFF, 0x00, 0x3C, 0x81, 0x7E, 0x01, 0x80, 0xF0, 0x0F};
+    for(uint32_t nCount = 0; nCount <= 64; ++nCount)
+    {
+        for(uint32_t nSrcBytes = 3; nSrcBytes <= 4; ++nSrcBytes)
+        {
+            std::vector<uint16_t> vDst16(nCount + 1, 0xAAAA);
+            std::vector<uint32_t> vDst32(nCount + 1, 0xAAAAAAAA);
+            if(nSrcBytes == 3)
+            {
+                fbConvertRow16Bgr(vSrc.data(), vDst16.data(), nCount, format);
+                fbConvertRow32Bgr(vSrc.data(), vDst32.data(), nCount);
+            }
+            else
+            {
+                fbConvertRow16Bgrx(vSrc.data(), vDst16.data(), nCount, format);
+                fbConvertRow32Bgrx(vSrc.data(), vDst32.data(), nCount);
+            }
+            bool bMatch = (vDst16[nCount] == 0xAAAA && vDst32[nCount] == 0xAAAAAAAA); //Nothing written beyond end
+            for(uint32_t n = 0; n < nCount; ++n)
+            {
+                const uint8_t* pPixel = &vSrc[n * nSrcBytes];
+                uint32_t nColour = ribanfblib::GetColour32(pPixel[2], pPixel[1], pPixel[0]);
+                bMatch &= (vDst16[n] == ribanfblib::GetColour(nColour, 16) && vDst32[n] == nColour);
+            }
+            CHECK(bMatch);
+        }
+        for(uint32_t nFirstBit = 0; nFirstBit < 8 && nFirstBit + nCount <= 80; ++nFirstBit)
+        {
+            std::vector<uint16_t> vDst16(nCount + 1, 0x1234);
+            std::vector<uint32_t> vDst32(nCount + 1, 0x123456);
+            fbGlyphRow16(anBits, nFirstBit, vDst16.data(), nCount, 0xF00F);
+            fbGlyphRow32(anBits, nFirstBit, vDst32.data(), nCount, 0xF0000F);
+            bool bMatch = (vDst16[nCount] == 0x1234 && vDst32[nCount] == 0x123456);
+            for(uint32_t n = 0; n < nCount; ++n)
+            {
+                uint32_t nBit = nFirstBit + n;
+                bool bSet = anBits[nBit >> 3] & (0x80 >> (nBit & 7));
+                bMatch &= (vDst16[n] == (bSet ? 0xF00F : 0x1234) && vDst32[n] == (bSet ? 0xF0000Fu : 0x123456u));
+            }
+            CHECK(bMatch);
+        }
+        std::vector<uint16_t> vFill16(nCount + 1, 0);
+        std::vector<uint32_t> vFill32(nCount + 1, 0);
+        fbFillSpan16(vFill16.data(), 0xBEEF, nCount);
+        fbFillSpan32(vFill32.data(), 0xC0FFEE, nCount);
+        CHECK(std::count(vFill16.begin(), vFill16.end(), 0xBEEF) == nCount && vFill16[nCount] == 0);
+        CHECK(std::count(vFill32.begin(), vFill32.end(), 0xC0FFEE) == nCount && vFill32[nCount] == 0);
+    }
+}
+
+void testComposite()
+{
+    ribanfblib fb(16, 16, 16);
+    ribanfblib surface(fb, 8, 8);
+    surface.Clear(RED);
+    surface.FillRect(4, 4, 4, 4, GREEN);
+
+    //Negative position draws only the visible part
+    CHECK(fb.Composite(surface, -4, -4));
+    CHECK(getPixel(fb, 0, 0) == fb.GetColour(GREEN));
+    CHECK(getPixel(fb, 3, 3) == fb.GetColour(RED));
+    CHECK(getPixel(fb, 4, 4) == fb.GetColour(BLACK));
+
+    //Clipped to target's clip rectangle
+    fb.Clear();
+    fb.SetClip(4, 4, 7, 7);
+    CHECK(fb.Composite(surface, 2, 2));
+    fb.ClearClip();
+    CHECK(getPixel(fb, 4, 4) == fb.GetColour(RED));
+    CHECK(getPixel(fb, 6, 6) == fb.GetColour(GREEN));
+    CHECK(getPixel(fb, 3, 3) == fb.GetColour(BLACK));
+    CHECK(getPixel(fb, 8, 8) == fb.GetColour(BLACK));
+
+    //Partly off the bottom right and wholly off screen
+    fb.Clear();
+    CHECK(fb.Composite(surface, 12, 12));
+    CHECK(getPixel(fb, 15, 15) == fb.GetColour(RED));
+    CHECK(getPixel(fb, 11, 11) == fb.GetColour(BLACK));
+    CHECK(fb.Composite(surface, 16, -8));
+
+    //Different colour depth is rejected and nothing is drawn
+    ribanfblib surface32(8, 8, 32);
+    surface32.Clear(WHITE);
+    fb.Clear();
+    CHECK(!fb.Composite(surface32, 0, 0));
+    CHECK(getPixel(fb, 0, 0) == fb.GetColour(BLACK));
+}
+
+void testThreadedComposite()
+{
+    //Two threads each draw to their own surface and composite to one half of a shared target without a lock
+    ribanfblib fb(64, 32, 16);
+    ribanfblib surface[2] = {ribanfblib(fb, 32, 32), ribanfblib(fb, 32, 32)};
+    auto worker = [&fb, &surface](int nThread)
+    {
+        ribanfblib& mine = surface[nThread];
+        for(int nFrame = 0; nFrame < 200; ++nFrame)
+        {
+            mine.Clear(nThread ? BLUE : RED);
+            mine.FillRect(nFrame % 24, 4, nFrame % 24 + 7, 11, WHITE);
+            mine.DrawText(std::to_string(nFrame), 2, 28, GREEN);
+            fb.Composite(mine, nThread * 32, 0);
+        }
+    };
+    std::thread threadA(worker, 0);
+    std::thread threadB(worker, 1);
+    threadA.join();
+    threadB.join();
+
+    //Target holds the last frame of each surface
+    CHECK(fb.SaveRaw(g_sTmpDir + "/target.raw"));
+    std::vector<uint8_t> vTarget = readFile(g_sTmpDir + "/target.raw");
+    for(int nThread = 0; nThread < 2; ++nThread)
+    {
+        CHECK(surface[nThread].SaveRaw(g_sTmpDir + "/surface.raw"));
+        std::vector<uint8_t> vSurface = readFile(g_sTmpDir + "/surface.raw");
+        bool bMatch = (vTarget.size() == 64 * 32 * 2 && vSurface.size() == 32 * 32 * 2);
+        for(int nRow = 0; bMatch && nRow < 32; ++nRow)
+            bMatch = !memcmp(&vTarget[(nRow * 64 + nThread * 32) * 2], &vSurface[nRow * 32 * 2], 32 * 2);
+        CHECK(bMatch);
+    }
+    CHECK(getPixel(fb, 0, 0) == fb.GetColour(RED));
+    CHECK(getPixel(fb, 63, 0) == fb.GetColour(BLUE));
+}
+
+/** @brief  Get the mean error of 8x8 pixel blocks of a grey gradient drawn to a surface
+*   @param  depth Colour depth of surface
+*   @param  dither Dithering mode
+*   @retval double Mean absolute difference between block average displayed and source values (all components)
+*/
+double gradientError(uint32_t depth, uint8_t dither)
+{
+    ribanfblib fb(256, 8, depth);
+    int nSprite = fb.LoadBitmap(g_sTmpDir + "/gradient.bmp", dither);
+    CHECK(nSprite == 0 && fb.DrawSprite(nSprite, 0, 0));
+    CHECK(fb.SavePpm(g_sTmpDir + "/gradient.ppm"));
+    std::vector<uint8_t> vPpm = readFile(g_sTmpDir + "/gradient.ppm");
+    const char* sHeader = "P6\n256 8\n255\n";
+    if(vPpm.size() != strlen(sHeader) + 256 * 8 * 3)
+        return 255;
+    const uint8_t* pRgb = vPpm.data() + strlen(sHeader);
+    double dError = 0;
+    for(uint32_t nBlock = 0; nBlock < 256; nBlock += 8)
+        for(uint32_t nComponent = 0; nComponent < 3; ++nComponent)
+        {
+            int nDisplayed = 0, nSource = 0;
+            for(uint32_t nRow = 0; nRow < 8; ++nRow)
+                for(uint32_t nX = nBlock; nX < nBlock + 8; ++nX)
+                {
+                    nDisplayed += pRgb[(nRow * 256 + nX) * 3 + nComponent];
+                    nSource += nX;
+                }
+            dError += abs(nDisplayed - nSource) / 64.0;
+        }
+    return dError / (32 * 3);
+}
+
+void testDither()
+{
+    writeBmp(g_sTmpDir + "/gradient.bmp", 256, 8, greyGradient);
+    //8-bit (RGB332) bands heavily without dithering. Dithering keeps the average of each block close to the source.
+    double dNone = gradientError(8, DITHER_NONE);
+    CHECK(dNone > 10);
+    CHECK(gradientError(8, DITHER_ORDERED) < 2);
+    CHECK(gradientError(8, DITHER_FLOYD_STEINBERG) < 2);
+    //16-bit (RGB565) bands less but dithering still reduces the error
+    dNone = gradientError(16, DITHER_NONE);
+    CHECK(gradientError(16, DITHER_ORDERED) < dNone * 0.8);
+    CHECK(gradientError(16, DITHER_FLOYD_STEINBERG) < dNone * 0.8);
+    //No reduction in colour depth so dithering has no effect
+    CHECK(gradientError(32, DITHER_NONE) == 0);
+    CHECK(gradientError(32, DITHER_ORDERED) == 0);
+    CHECK(gradientError(32, DITHER_FLOYD_STEINBERG) == 0);
+}
+
+int main(int argc, char* argv[])
+{
+    char sTmpDir[] = "/tmp/fbtestsXXXXXX";
+    if(!mkdtemp(sTmpDir))
+    {
+        fprintf(stderr, "Failed to create temporary directory\n");
+        return 1;
+    }
+    g_sTmpDir = sTmpDir;
+
+    testMemorySurface();
+    testKernels();
+    testComposite();
+    testThreadedComposite();
+    testDither();
+    testSceneDamage();
+    testGaugePartialRedraw();
+    testSchedulerSkip();
+    testSchedulerPercentiles();
+    testRecordReplay(argc > 1 ? argv[1] : "./fbreplay");
+    testRecordHint();
+    testSpriteClipping();
+    testBitmapFileLimits();
+    testBitmapFileMatchesSprite();
+
+    std::string sCommand = "rm -rf " + g_sTmpDir;
+    if(system(sCommand.c_str()) != 0)
+        fprintf(stderr, "Failed to remove %s\n", sTmpDir);
+    if(g_nFailures)
+        fprintf(stderr, "%d checks failed\n", g_nFailures);
+    else
+        printf("All tests passed\n");
+    return g_nFailures ? 1 : 0;
+}
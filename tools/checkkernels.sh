@@ -0,0 +1,42 @@
+#!/bin/sh
+# Check that the instruction set variants of each pixel kernel are different code.
+# If the compiler does not vectorise a kernel every variant is the same scalar loop and runtime dispatch gains nothing.
+# Usage: checkkernels.sh [library]
+
+LIB=${1:-libribanfb.so}
+KERNELS="fbFillSpan16 fbFillSpan32 fbConvertRow16Bgr fbConvertRow16Bgrx fbConvertRow32Bgr fbConvertRow32Bgrx fbGlyphRow16 fbGlyphRow32"
+
+case "$(uname -m)" in
+    x86_64|i?86) ;;
+    *) echo "Kernel variant check only supported on x86 - skipped"; exit 0 ;;
+esac
+if ! command -v objdump > /dev/null; then
+    echo "objdump not found - kernel variant check skipped"
+    exit 0
+fi
+
+DISASSEMBLY=$(objdump -d --no-show-raw-insn "$LIB") || exit 1
+
+# Print the instruction mnemonics of a function variant, e.g. mnemonics fbFillSpan16 avx2
+mnemonics() {
+    echo "$DISASSEMBLY" | awk -v label="<_Z[0-9]+$1[A-Z][A-Za-z0-9_]*[.]$2>:" \
+        '$0 ~ label {found = 1; next} found && /^$/ {exit} found {split($0, field, "\t"); split(field[2], word, " "); print word[1]}'
+}
+
+FAILED=0
+for KERNEL in $KERNELS; do
+    DEFAULT=$(mnemonics $KERNEL default)
+    AVX2=$(mnemonics $KERNEL avx2)
+    if [ -z "$DEFAULT" ] || [ -z "$AVX2" ]; then
+        echo "FAIL $KERNEL: variants not found in $LIB"
+        FAILED=1
+    elif [ "$DEFAULT" = "$AVX2" ]; then
+        echo "FAIL $KERNEL: default and avx2 variants are the same code"
+        FAILED=1
+    elif ! echo "$AVX2" | grep -q '^v'; then
+        echo "FAIL $KERNEL: avx2 variant has no AVX instructions"
+        FAILED=1
+    fi
+done
+[ $FAILED -eq 0 ] && echo "Kernel variants differ"
+exit $FAILED
@@ -0,0 +1,123 @@
+/*  Replay a screen recording made by riban Framebuffer Library
+    Copyright riban 2019
+    Author: Brian Walton brian@riban.co.uk
+
+    Reconstructs each frame of a recording created with ribanfblib::StartRecording and writes it as a PPM file.
+    Usage: fbreplay <recording> <output prefix> [frame]
+    Frames are written as <output prefix>NNNNN.ppm. If frame is given only that frame is written.
+*/
+
+#include "../ribanfblib.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <new>
+
+/** @brief  Check a recording header describes a frame that can be replayed safely
+*   @param  header Recording header
+*   @retval bool True if header is valid
+*/
+bool validHeader(const ribanfbRecordHeader& header)
+{
+    if(memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) || header.version != RECORD_VERSION)
+        return false;
+    if(header.depth != 8 && header.depth != 16 && header.depth != 24 && header.depth != 32)
+        return false;
+    if(header.width == 0 || header.height == 0 || (uint64_t)header.width * header.depth / 8 != header.rowBytes)
+        return false;
+    if((uint64_t)header.rowBytes * header.height > SIZE_MAX)
+        return false; //Frame too large to hold in memory
+    //Components are at most 8 bits and must lie within the pixel
+    const fb_bitfield* pFields[3] = {&header.red, &header.green, &header.blue};
+    for(int nComponent = 0; nComponent < 3; ++nComponent)
+        if(pFields[nComponent]->length == 0 || pFields[nComponent]->length > 8
+           || pFields[nComponent]->offset > header.depth - pFields[nComponent]->length)
+            return false;
+    return true;
+}
+
+bool savePpm(const char* sPrefix, uint32_t nFrame, const ribanfbRecordHeader& header, ribanfbRgbConverter& converter,
+             const std::vector<uint8_t>& vFrame)
+{
+    char sFilename[1024];
+    snprintf(sFilename, sizeof(sFilename), "%s%05u.ppm", sPrefix, nFrame);
+    FILE* pFile = fopen(sFilename, "wb");
+    if(!pFile)
+        return false;
+    fprintf(pFile, "P6\n%u %u\n255\n", header.width, header.height);
+    std::vector<uint8_t> vRow((size_t)header.width * 3);
+    bool bSuccess = true;
+    for(uint32_t nRow = 0; nRow < header.height && bSuccess; ++nRow)
+    {
+        converter.Convert(vFrame.data() + (size_t)nRow * header.rowBytes, vRow.data(), header.width);
+        bSuccess = (fwrite(vRow.data(), vRow.size(), 1, pFile) == 1);
+    }
+    fclose(pFile);
+    return bSuccess;
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <recording> <output prefix> [frame]\n", argv[0]);
+        return 1;
+    }
+    int nOnlyFrame = (argc > 3) ? atoi(argv[3]) : -1;
+    FILE* pFile = fopen(argv[1], "rb");
+    if(!pFile)
+    {
+        fprintf(stderr, "Failed to open %s\n", argv[1]);
+        return 1;
+    }
+    ribanfbRecordHeader header;
+    if(fread(&header, sizeof(header), 1, pFile) != 1 || !validHeader(header))
+    {
+        fprintf(stderr, "%s is not a supported recording\n", argv[1]);
+        fclose(pFile);
+        return 1;
+    }
+    std::vector<uint8_t> vFrame;
+    try
+    {
+        vFrame.resize((size_t)header.rowBytes * header.height);
+    }
+    catch(const std::bad_alloc&)
+    {
+        fprintf(stderr, "Insufficient memory for %ux%u frame\n", header.width, header.height);
+        fclose(pFile);
+        return 1;
+    }
+    ribanfbRgbConverter converter(header.depth, header.red, header.green, header.blue);
+
+    uint32_t nFrame = 0;
+    ribanfbRecordFrame frame;
+    while(fread(&frame, sizeof(frame), 1, pFile) == 1)
+    {
+        for(uint32_t nRange = 0; nRange < frame.ranges; ++nRange)
+        {
+            ribanfbRecordRange range;
+            if(fread(&range, sizeof(range), 1, pFile) != 1 || range.first > header.height || range.count > header.height - range.first
+               || (range.count && fread(vFrame.data() + (size_t)range.first * header.rowBytes, (size_t)header.rowBytes * range.count, 1, pFile) != 1))
+            {
+                fprintf(stderr, "Recording truncated in frame %u\n", nFrame);
+                fclose(pFile);
+                return 1;
+            }
+        }
+        if(nOnlyFrame < 0 || nOnlyFrame == (int)nFrame)
+        {
+            if(!savePpm(argv[2], nFrame, header, converter, vFrame))
+                fprintf(stderr, "Failed to write frame %u\n", nFrame);
+            else
+                printf("Frame %u at %ums\n", nFrame, frame.time);
+        }
+        if(nOnlyFrame == (int)nFrame)
+            break;
+        ++nFrame;
+    }
+    fclose(pFile);
+    return 0;
+}